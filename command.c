@@ -0,0 +1,362 @@
+/*
+**************************************************************************************************************
+* file: command.c
+* brief: Streaming parser for messages from the GUI
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "command.h"
+#include "crc.h"
+#include "eeprom_log.h"
+#include "frame.h"
+#include "hardware.h"
+#include "latency.h"
+#include "led.h"
+#include "macros.h"
+#include "memory.h"
+#include "pot.h"
+#include "profile.h"
+#include "report.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "timer.h"
+#include "uart.h"
+#include <avr/pgmspace.h>
+
+/*
+ * Bytes are taken from the UART input buffer as they arrive and fed through a small state
+ * machine, so a message that is only partly received never holds up the controller. Each command
+ * letter is looked up in a table giving its number of data bytes and the function that carries it
+ * out.
+ */
+
+/* Parser states */
+#define PARSE_IDLE 0 // Waiting for a command letter or FRAME_SYNC
+#define PARSE_DATA 1 // Collecting the data bytes of a text command
+#define PARSE_FRAME_LENGTH 2 // Waiting for the payload length of a frame
+#define PARSE_FRAME_PAYLOAD 3 // Collecting the payload of a frame
+#define PARSE_FRAME_CRC 4 // Waiting for the CRC of a frame
+
+typedef void (*CommandHandler)(uint8_t* data);
+
+typedef struct {
+    char addr; // Command letter
+    uint8_t length; // Number of data bytes
+    CommandHandler handler;
+} Command;
+
+/** Changes one channel of the LED colour and saves it. The other channels keep the colour being
+* shown, which is the streamed colour if it hasn't been saved yet.
+*
+* Variables:
+* channel: 0 for red, 1 for green, 2 for blue
+* level: the new level of the channel
+*/
+static void command_channel(uint8_t channel, uint8_t level)
+{
+    uint8_t colour[3] = { settings.ledRed, settings.ledGreen, settings.ledBlue };
+
+    led_stream_colour(colour);
+    colour[channel] = level;
+    set_duty_cycles(colour[0], colour[1], colour[2]);
+}
+
+static void command_red(uint8_t* data)
+{
+    command_channel(0, data[0]);
+}
+
+static void command_green(uint8_t* data)
+{
+    command_channel(1, data[0]);
+}
+
+static void command_blue(uint8_t* data)
+{
+    command_channel(2, data[0]);
+}
+
+static void command_colour(uint8_t* data)
+{
+    set_duty_cycles(data[0], data[1], data[2]);
+}
+
+static void command_volume(uint8_t* data)
+{
+    set_volume(data[0]);
+}
+
+static void command_volume_up(uint8_t* data)
+{
+    pot_nudge(1);
+}
+
+static void command_volume_down(uint8_t* data)
+{
+    pot_nudge(0);
+}
+
+static void command_pot(uint8_t* data)
+{
+    pot_query();
+}
+
+static void command_dpad(uint8_t* data)
+{
+    save_em_mode(data[0]);
+}
+
+static void command_press_debounce(uint8_t* data)
+{
+    set_debounce(data[0], 0);
+}
+
+static void command_release_debounce(uint8_t* data)
+{
+    set_debounce(0, data[0]);
+}
+
+static void command_eager(uint8_t* data)
+{
+    set_eager_press(data[0]);
+}
+
+static void command_interval(uint8_t* data)
+{
+    set_report_interval(data[0]);
+}
+
+static void command_wear(uint8_t* data)
+{
+    uint16_t wear[2] = { log_records_written(), log_cell_writes() };
+
+    telemetry_reply(WEAR[0], wear, 2);
+}
+
+static void command_wire_mode(uint8_t* data)
+{
+    set_wire_mode(data[0]);
+}
+
+static void command_baud(uint8_t* data)
+{
+    request_baud(data[0]);
+}
+
+static void command_stream(uint8_t* data)
+{
+    led_stream(data[0], data[1], data[2]);
+}
+
+static void command_commit(uint8_t* data)
+{
+    led_stream_commit();
+}
+
+static void command_effects(uint8_t* data)
+{
+    set_led_effects(data[0]);
+}
+
+static void command_stats(uint8_t* data)
+{
+    stats_query(data[0]);
+}
+
+static void command_latency(uint8_t* data)
+{
+    latency_query(data[0]);
+}
+
+static void command_tasks(uint8_t* data)
+{
+    scheduler_query(data[0]);
+}
+
+#ifdef PROFILE
+static void command_profile(uint8_t* data)
+{
+    profile_query(data[0]);
+}
+#endif
+
+static const Command commands[] PROGMEM = {
+    { 'R', 1, command_red },
+    { 'G', 1, command_green },
+    { 'B', 1, command_blue },
+    { 'C', 3, command_colour }, // Red, green and blue together
+    { 'V', 1, command_volume },
+    { '+', 1, command_volume_up }, // Data byte ignored
+    { '-', 1, command_volume_down }, // Data byte ignored
+    { 'O', 1, command_pot }, // Data byte ignored
+    { 'D', 1, command_dpad },
+    { 'P', 1, command_press_debounce },
+    { 'L', 1, command_release_debounce },
+    { 'E', 1, command_eager },
+    { 'I', 1, command_interval },
+    { 'W', 1, command_wear }, // Data byte ignored
+    { 'M', 1, command_wire_mode },
+    { 'U', 1, command_baud },
+    { 'S', 3, command_stream }, // Red, green and blue, shown but not saved
+    { 'K', 1, command_commit }, // Data byte ignored
+    { 'A', 1, command_effects }, // '0' + LED_EFFECT_ flags
+    { 'Q', 1, command_stats }, // Page to read or STATS_RESET
+    { 'H', 1, command_latency }, // Page to read or LATENCY_RESET
+    { 'T', 1, command_tasks }, // Task to read or SCHEDULER_RESET
+#ifdef PROFILE
+    { 'F', 1, command_profile }, // Stage to read or PROFILE_RESET
+#endif
+};
+
+#define COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static uint8_t parseState = PARSE_IDLE;
+static int8_t command; // Index into commands of the text command being received
+static uint8_t data[FRAME_MAX_PAYLOAD]; // Data bytes of a text command or the payload of a frame
+static uint8_t dataLength; // Number of bytes expected in data
+static uint8_t dataPos; // Number of bytes received into data
+static uint8_t crc; // Running CRC of the frame being received
+static uint16_t lastByte; // Tick count when the last byte was received
+
+/** Looks up a command letter.
+*
+* Returns:
+* index: the index of the command in commands, or -1 if the letter is not a command
+*/
+static int8_t command_find(uint8_t addr)
+{
+    for (uint8_t i = 0; i < COMMANDS; i++) {
+        if (pgm_read_byte(&commands[i].addr) == addr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** Returns the number of data bytes taken by a command */
+static uint8_t command_length(int8_t index)
+{
+    return pgm_read_byte(&commands[index].length);
+}
+
+/** Carries out a command.
+*
+* Variables:
+* index: the index of the command in commands
+* args: the data bytes of the command
+*/
+static void command_dispatch(int8_t index, uint8_t* args)
+{
+    CommandHandler handler = (CommandHandler)pgm_read_word(&commands[index].handler);
+
+    handler(args);
+}
+
+/** Carries out every command in a frame payload. A payload that doesn't split exactly into
+* commands is thrown away without carrying out any of it.
+*/
+static void command_frame(void)
+{
+    uint8_t pos = 0;
+
+    /* Check the whole payload first so a bad frame has no effect */
+    while (pos < dataPos) {
+        int8_t index = command_find(data[pos]);
+        if (index < 0) {
+            return;
+        }
+        pos += 1 + command_length(index);
+    }
+    if (pos != dataPos) {
+        return;
+    }
+
+    for (pos = 0; pos < dataPos; pos += 1 + command_length(command_find(data[pos]))) {
+        command_dispatch(command_find(data[pos]), &data[pos + 1]);
+    }
+}
+
+/** Feeds one received byte through the parser.
+*
+* Variables:
+* c: the received byte
+*/
+static void command_parse(uint8_t c)
+{
+    switch (parseState) {
+    case PARSE_IDLE:
+        if (c == FRAME_SYNC) {
+            parseState = PARSE_FRAME_LENGTH;
+            break;
+        }
+        command = command_find(c);
+        if (command < 0) {
+            break; // Not a command, skip it to get back in step.
+        }
+        dataLength = command_length(command);
+        dataPos = 0;
+        parseState = PARSE_DATA;
+        break;
+
+    case PARSE_DATA:
+        data[dataPos++] = c;
+        if (dataPos == dataLength) {
+            parseState = PARSE_IDLE;
+            command_dispatch(command, data);
+        }
+        break;
+
+    case PARSE_FRAME_LENGTH:
+        if (c == 0 || c > FRAME_MAX_PAYLOAD) {
+            parseState = PARSE_IDLE;
+            break;
+        }
+        crc = crc8_update(CRC8_INIT, c);
+        dataLength = c;
+        dataPos = 0;
+        parseState = PARSE_FRAME_PAYLOAD;
+        break;
+
+    case PARSE_FRAME_PAYLOAD:
+        crc = crc8_update(crc, c);
+        data[dataPos++] = c;
+        if (dataPos == dataLength) {
+            parseState = PARSE_FRAME_CRC;
+        }
+        break;
+
+    case PARSE_FRAME_CRC:
+        parseState = PARSE_IDLE;
+        if (c == crc) {
+            uart_baud_confirm(); // Only a frame that passed its CRC shows the GUI is talking at the current baud rate.
+            command_frame();
+        }
+        break;
+
+    default:
+        parseState = PARSE_IDLE;
+        break;
+    }
+}
+
+/** Parses whatever bytes the GUI has sent so far and carries out every complete message. Partly
+* received messages are kept until the rest arrives, so this never blocks. Called by the commands
+* task every 1ms.
+*/
+void command_task(void)
+{
+    int16_t c;
+
+    while ((c = uart_get_byte()) >= 0) {
+        uint16_t now = timer_ticks();
+
+        /* Throw away a message the GUI stopped sending part way through */
+        if (parseState != PARSE_IDLE && (uint16_t)(now - lastByte) > COMMAND_TIMEOUT_MS) {
+            parseState = PARSE_IDLE;
+        }
+        lastByte = now;
+        command_parse(c);
+    }
+}
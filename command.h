@@ -0,0 +1,27 @@
+/*
+**************************************************************************************************************
+* file: command.h
+* brief: Streaming parser for messages from the GUI
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __COMMAND_H__
+#define __COMMAND_H__
+
+#include <stdint.h>
+
+#define COMMAND_TIMEOUT_MS 100 // A message not finished within this time is thrown away
+
+/** Parses whatever bytes the GUI has sent so far and carries out every complete message. Partly
+* received messages are kept until the rest arrives, so this never blocks. Called by the commands
+* task every 1ms.
+*
+* Two message formats are accepted at any time:
+*	text: a command letter followed by its data bytes, e.g. 'V' volume or 'C' red green blue
+*	binary: a frame (see frame.h) whose payload is one or more command letters each followed by
+*		its data bytes, all carried out together once the CRC has been checked
+*/
+void command_task(void);
+
+#endif
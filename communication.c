@@ -9,72 +9,415 @@
 #include "communication.h"
 #include "macros.h"
 #include "spi.h"
-#include "uart.h"
-#include <stdio.h>
-#include <util/delay.h>
+#include "stats.h"
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 
-/** Updates the GamePad by sending 'reg' and 'data' bytes to turtle followed by 'SEND_REPORT'
-* over SPI.
+/*
+ * Turtle link. The turtle shifts a status byte out on MISO while the first byte of every transaction
+ * is sent, saying whether it is ready and which SEND_REPORT it last committed. Each SEND_REPORT
+ * carries a sequence number in its second byte so it can be acknowledged. At boot the link is
+ * calibrated to find how long SS really has to be held high between transactions, and afterwards
+ * the status bytes are checked so a report the turtle wasn't ready for is sent again and the guard
+ * times are backed off. Once the turtle has acknowledged enough reports in a row the guard times
+ * decay back towards the calibrated ones. If no other transaction follows a report, the turtle is polled for its
+ * acknowledgement so a lost report doesn't wait for the next input change to be noticed.
+ */
+
+/* Guard times tried by the calibration, shortest first */
+static const uint16_t guardSteps[] PROGMEM = { 20, 50, 100, 200, 500 };
+#define GUARD_STEPS (sizeof(guardSteps) / sizeof(guardSteps[0]))
+
+static uint16_t registerGuardUs = TURTLE_REGISTER_GUARD_US;
+static uint16_t reportGuardUs = TURTLE_REPORT_GUARD_US;
+/* Guard times found by the calibration, backed off guard times decay back to these */
+static uint16_t calibratedRegisterGuardUs = TURTLE_REGISTER_GUARD_US;
+static uint16_t calibratedReportGuardUs = TURTLE_REPORT_GUARD_US;
+static uint8_t goodAcks = 0; // Reports acknowledged since the guard times last changed
+static uint8_t reportSeq = 0; // Sequence number of the next SEND_REPORT
+
+/* Set by the SPI ISR */
+static volatile uint8_t turtleSeen; // True once a status byte with the signature has been received
+static volatile uint8_t turtleBusy; // True if the turtle said it wasn't ready
+static volatile uint8_t turtleLost; // True if a report may not have been committed
+static volatile uint8_t ackPending; // True if the last SEND_REPORT hasn't been acknowledged yet
+static volatile uint8_t ackSeq; // Sequence number of the last SEND_REPORT
+static volatile uint8_t ackCount; // Reports acknowledged since turtle_link_lost() last ran
+
+/* Results of potentiometer reads made in the background, one slot per readable register */
+#define POT_READ_SLOT(command) ((command) == POT_STATUS_READ)
+static volatile uint16_t potReadValue[2];
+static volatile uint8_t potReadDone; // Bit n is set once the read for slot n has finished
+static volatile uint8_t potReadHigh; // First byte of the read being received
+
+/** Queues the 'data' byte to be written to the turtle register 'reg' over SPI without sending
+* 'SEND_REPORT'. The change is not pushed to the GamePad until spi_send_report() is called.
 *
 * reg: is the appropriate register macro for SPI protocol as per macros.h (e.g. BR0, JSX, DPAD, etc.)
 * data: is the data byte to be sent via SPI.
 *
-* SEND_REPORT must be sent to the turtle in order to actually push the changes to the GamePad.
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the write
+* SPI_OK: returned if the write was queued
 */
-void spi_update(char reg, char data)
+uint8_t spi_write_register(char reg, char data)
 {
-    _delay_us(100); //Ensures SS has been held high long enough after previous message
-    select_turtle();
-    spi_master_transmit(reg);
-    spi_master_transmit(data);
-    deselect_turtle();
+    uint8_t message[2] = { reg, data };
 
-    _delay_ms(1); // Ensures SS is held high for long enough to be recognised by turtle.
-
-    // Telling the Turtle to update the GamePad
-    select_turtle();
-    spi_master_transmit(SEND_REPORT);
-    spi_master_transmit(0x00);
-    deselect_turtle();
+    return spi_enqueue(SPI_SLAVE_TURTLE, message, 2, registerGuardUs);
 }
 
-/** Sends the bytes passed to it using UART communication.
-*
-* addr: is the appropriate register macro for UART protocol as per macros.h (e.g. BUTTON, RLED, etc.)
-* data: is the data byte to sent via UART
+/** Queues 'SEND_REPORT' to tell the turtle to push the current contents of its registers to the
+* GamePad. The second byte is a sequence number the turtle acknowledges in its status byte.
 *
-* The message is sent via a printf call of this format:
-*	printf("%s%c\n", addr, data);
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the report
+* SPI_OK: returned if the report was queued
 */
-void uart_update(char* addr, char data)
+uint8_t spi_send_report(void)
 {
-    printf("%s%c\n", addr, data);
+    uint8_t message[2] = { SEND_REPORT, reportSeq };
+
+    if (spi_enqueue(SPI_SLAVE_TURTLE, message, 2, reportGuardUs) != SPI_OK) {
+        return SPI_QUEUE_FULL;
+    }
+    reportSeq++;
+    return SPI_OK;
 }
 
-/** Updates the GUI and GamePad with the data passed to it.
+/** Updates the GamePad with a full controller snapshot. BR0, JSX, JSY and DPAD are written in one
+* burst and committed with exactly one 'SEND_REPORT', so the GamePad never sees a half updated state.
+* The frame is only queued if all of it fits, and is then sent in the background.
 *
-* addr: is the appropriate register macro for UART protocol as per macros.h (e.g. BUTTON, RLED, etc.)
-* reg: is the appropriate register macro for SPI protocol as per macros.h (e.g. BR0, JSX, DPAD, etc.)
-* data: is the data byte to be sent via UART and SPI
+* frame: the controller snapshot to be sent to the turtle
 *
-* This method calls uart_update() and spi_update to send the macro and data bytes over the respective
-* communication platform.
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the frame, nothing was queued
+* SPI_OK: returned if the frame was queued
 */
-void update(char* addr, char reg, char data)
+uint8_t spi_update_frame(ReportFrame* frame)
 {
-    spi_update(reg, data);
-    uart_update(addr, data);
+    if (spi_queue_space() < REPORT_FRAME_TRANSACTIONS) {
+        return SPI_QUEUE_FULL;
+    }
+
+    spi_write_register(BR0, frame->buttons);
+    spi_write_register(JSX, frame->x);
+    spi_write_register(JSY, frame->y);
+    spi_write_register(DPAD, frame->dpad);
+    spi_send_report();
+    return SPI_OK;
 }
 
-/** Updates the potentiometer wiper values using SPI.
+/** Updates the potentiometer wiper values using SPI. The update is queued and sent in the
+* background, waiting for room in the SPI queue if necessary.
 *
 * w1: the value to be written to wiper 1 of the potentiometer
 * w2: the value to be written to wiper 2 of the potentiometer
 */
 void pot_update(char w1, char w2)
 {
+    uint8_t message[2] = { w1, w2 };
+
+    while (spi_enqueue(SPI_SLAVE_POT, message, 2, 0) != SPI_OK)
+        ;
+}
+
+/** Queues a single byte potentiometer command, such as POT_WIPER0_INCREMENT, to be sent 'count'
+* times in one chip select window, so several wiper steps cost one short SPI transaction.
+*
+* command: the command byte (POT_WIPER0_INCREMENT or POT_WIPER0_DECREMENT)
+* count: the number of times to send it (1 - SPI_TRANSACTION_MAX)
+*
+* Returns:
+* SPI_INVALID_LENGTH: returned if count is out of range, nothing was queued
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the command
+* SPI_OK: returned if the command was queued
+*/
+uint8_t pot_step(uint8_t command, uint8_t count)
+{
+    uint8_t message[SPI_TRANSACTION_MAX];
+
+    if (count == 0 || count > SPI_TRANSACTION_MAX) {
+        return SPI_INVALID_LENGTH;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        message[i] = command;
+    }
+    return spi_enqueue(SPI_SLAVE_POT, message, count, 0);
+}
+
+/** Works out a 9 bit register value from the two bytes read back from the potentiometer.
+*
+* Returns:
+* POT_READ_ERROR: returned if the potentiometer flagged the command as invalid
+* value: the 9 bit register value otherwise
+*/
+static uint16_t pot_read_value(uint8_t high, uint8_t low)
+{
+    if (!(high & POT_CMDERR)) {
+        return POT_READ_ERROR;
+    }
+    return ((uint16_t)(high & 0x01) << 8) | low;
+}
+
+/** Reads a 9 bit potentiometer register. Waits for the SPI queue to empty and then does a blocking
+* transfer, so it is only used at boot. Tasks use pot_read_queue() instead.
+*
+* command: the read command for the register (POT_WIPER0_READ or POT_STATUS_READ)
+*
+* Returns:
+* POT_READ_ERROR: returned if the potentiometer flagged the command as invalid
+* value: the 9 bit register value otherwise
+*/
+uint16_t pot_read(uint8_t command)
+{
+    spi_flush();
+
     select_pot();
-    spi_master_transmit(w1);
-    spi_master_transmit(w2);
+    uint8_t high = spi_master_transmit(command);
+    uint8_t low = spi_master_transmit(0xFF);
     deselect_pot();
-}
\ No newline at end of file
+
+    return pot_read_value(high, low);
+}
+
+/** Queues a read of a 9 bit potentiometer register. The read is sent in the background and its
+* result collected with pot_read_result() once it has arrived, so this returns straight away.
+*
+* command: the read command for the register (POT_WIPER0_READ or POT_STATUS_READ)
+*
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the read
+* SPI_OK: returned if the read was queued
+*/
+uint8_t pot_read_queue(uint8_t command)
+{
+    uint8_t message[2] = { command, 0xFF };
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        potReadDone &= ~(1 << POT_READ_SLOT(command));
+    }
+    return spi_enqueue(SPI_SLAVE_POT, message, 2, 0);
+}
+
+/** Handles a byte received from the potentiometer while a byte of 'command' was sent. Records the
+* result of a read queued by pot_read_queue() once both of its bytes have arrived. Called from the
+* SPI ISR.
+*
+* command: the first byte of the transaction
+* index: the position of the byte in the transaction
+* received: the byte received from the potentiometer
+*/
+void pot_read_byte(uint8_t command, uint8_t index, uint8_t received)
+{
+    if (command != POT_WIPER0_READ && command != POT_STATUS_READ) {
+        return; // Not a read, nothing useful comes back.
+    }
+
+    if (index == 0) {
+        potReadHigh = received;
+        return;
+    }
+    potReadValue[POT_READ_SLOT(command)] = pot_read_value(potReadHigh, received);
+    potReadDone |= (1 << POT_READ_SLOT(command));
+}
+
+/** Collects the result of the last read queued by pot_read_queue() for a register.
+*
+* command: the read command for the register (POT_WIPER0_READ or POT_STATUS_READ)
+* value: set to the 9 bit register value, or POT_READ_ERROR if the potentiometer flagged the command
+*	as invalid
+*
+* Returns:
+* boolean: true if the read has finished and value has been set, false if it is still waiting
+*/
+uint8_t pot_read_result(uint8_t command, uint16_t* value)
+{
+    uint8_t done;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        done = potReadDone & (1 << POT_READ_SLOT(command));
+        *value = potReadValue[POT_READ_SLOT(command)];
+    }
+    return done != 0;
+}
+
+/** Clears the flags set by turtle_link_status() without acting on them */
+static void turtle_link_clear(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        turtleBusy = 0;
+        turtleLost = 0;
+        ackCount = 0;
+    }
+}
+
+/** Measures the shortest time SS has to be held high between transactions for the turtle to be
+* ready for the next one, and uses it (with a margin) for every turtle transaction from then on.
+* If the turtle doesn't send status bytes the legacy guard times are kept. Blocks for a few
+* milliseconds, so it is only called once at boot after Timer1 and SPI have been initialised.
+*/
+void turtle_link_calibrate(void)
+{
+    /* Check the turtle sends status bytes at all, using the legacy guard times */
+    while (spi_write_register(BR0, 0) != SPI_OK)
+        ;
+    spi_flush();
+    if (!turtleSeen) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < GUARD_STEPS; i++) {
+        uint16_t guard = pgm_read_word(&guardSteps[i]);
+        uint8_t ok = 1;
+
+        registerGuardUs = guard;
+        reportGuardUs = guard;
+        for (uint8_t try = 0; try < TURTLE_CALIBRATE_TRIES && ok; try++) {
+            turtle_link_clear();
+
+            /* A register write and a report, then a probe whose status byte acknowledges the report */
+            while (spi_queue_space() < 3)
+                ;
+            spi_write_register(BR0, 0);
+            spi_send_report();
+            spi_write_register(BR0, 0);
+            spi_flush();
+
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                ok = !turtleBusy && !turtleLost;
+            }
+        }
+
+        if (ok) {
+            registerGuardUs = (guard * TURTLE_GUARD_MARGIN < TURTLE_REGISTER_GUARD_US) ? guard * TURTLE_GUARD_MARGIN : TURTLE_REGISTER_GUARD_US;
+            reportGuardUs = guard * TURTLE_GUARD_MARGIN;
+            calibratedRegisterGuardUs = registerGuardUs;
+            calibratedReportGuardUs = reportGuardUs;
+            turtle_link_clear();
+            return;
+        }
+    }
+
+    /* Nothing shorter worked */
+    registerGuardUs = TURTLE_REGISTER_GUARD_US;
+    reportGuardUs = TURTLE_REPORT_GUARD_US;
+    calibratedRegisterGuardUs = registerGuardUs;
+    calibratedReportGuardUs = reportGuardUs;
+    turtle_link_clear();
+}
+
+/** Handles the status byte the turtle sent during the first byte of a transaction. Checks the
+* turtle was ready and has committed the last SEND_REPORT. Called from the SPI ISR.
+*
+* status: the byte received from the turtle
+* command: the first byte of the transaction (a register or SEND_REPORT)
+* arg: the second byte of the transaction (the data or the report sequence number)
+*/
+void turtle_link_status(uint8_t status, uint8_t command, uint8_t arg)
+{
+    if ((status & TURTLE_SIGNATURE_MASK) != TURTLE_SIGNATURE) {
+        return; // Older turtle firmware, or nothing connected.
+    }
+    turtleSeen = 1;
+
+    if (!(status & TURTLE_READY)) {
+        turtleBusy = 1;
+        turtleLost = 1;
+        STATS_COUNT(turtleNotReady);
+    }
+
+    /* The status byte describes the turtle before this transaction, so it acknowledges the last report */
+    if (ackPending) {
+        ackPending = 0;
+        if ((status & TURTLE_SEQ_MASK) != (ackSeq & TURTLE_SEQ_MASK)) {
+            turtleLost = 1;
+            STATS_COUNT(turtleReportsLost);
+        } else if (ackCount < 255) {
+            ackCount++;
+        }
+    }
+
+    if (command == SEND_REPORT) {
+        ackPending = 1;
+        ackSeq = arg;
+    }
+}
+
+/** Checks whether the turtle has reported being busy or has missed a report since the last call.
+* If it was busy the guard times are doubled, up to the legacy guard times. Once the turtle has
+* acknowledged TURTLE_GUARD_DECAY_ACKS reports in a row they are halved, down to the
+* calibrated guard times.
+*
+* Returns:
+* boolean: true if a report may have been lost and should be sent again, false otherwise
+*/
+uint8_t turtle_link_lost(void)
+{
+    uint8_t busy;
+    uint8_t lost;
+    uint8_t acks;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        busy = turtleBusy;
+        lost = turtleLost;
+        acks = ackCount;
+        turtleBusy = 0;
+        turtleLost = 0;
+        ackCount = 0;
+    }
+
+    if (busy) {
+        registerGuardUs = (registerGuardUs * 2 < TURTLE_REGISTER_GUARD_US) ? registerGuardUs * 2 : TURTLE_REGISTER_GUARD_US;
+        reportGuardUs = (reportGuardUs * 2 < TURTLE_REPORT_GUARD_US) ? reportGuardUs * 2 : TURTLE_REPORT_GUARD_US;
+    }
+
+    /* A busy turtle also loses the report, so either way the run of acknowledged reports is over */
+    if (lost) {
+        goodAcks = 0;
+        return lost;
+    }
+
+    goodAcks = (goodAcks + acks < TURTLE_GUARD_DECAY_ACKS) ? goodAcks + acks : TURTLE_GUARD_DECAY_ACKS;
+    if (goodAcks == TURTLE_GUARD_DECAY_ACKS) {
+        registerGuardUs = (registerGuardUs / 2 > calibratedRegisterGuardUs) ? registerGuardUs / 2 : calibratedRegisterGuardUs;
+        reportGuardUs = (reportGuardUs / 2 > calibratedReportGuardUs) ? reportGuardUs / 2 : calibratedReportGuardUs;
+        goodAcks = 0;
+    }
+    return lost;
+}
+
+/** Polls the turtle for the acknowledgement of the last SEND_REPORT once the SPI queue has gone
+* idle, by writing 'buttons' to BR0 again. The write waits for the report guard time so the turtle
+* has had time to commit the report. Does nothing if no acknowledgement is waiting.
+*
+* buttons: the value BR0 was last set to, so the write doesn't change the turtle registers
+*/
+void turtle_link_probe(uint8_t buttons)
+{
+    if (!ackPending || spi_busy()) {
+        return;
+    }
+
+    uint8_t message[2] = { BR0, buttons };
+    spi_enqueue(SPI_SLAVE_TURTLE, message, 2, reportGuardUs);
+}
+
+/** Returns the guard time currently used before turtle register writes in microseconds */
+uint16_t turtle_register_guard(void)
+{
+    return registerGuardUs;
+}
+
+/** Returns the guard time currently used before SEND_REPORT in microseconds */
+uint16_t turtle_report_guard(void)
+{
+    return reportGuardUs;
+}
@@ -9,42 +9,171 @@
 #ifndef __COMMUNICATION_H__
 #define __COMMUNICATION_H__
 
-/** Updates the GUI and GamePad with the data passed to it.
+#include <stdint.h>
+
+/* Minimum time SS must be held high before each turtle transaction, used unless link calibration
+ * finds the turtle needs less */
+#define TURTLE_REGISTER_GUARD_US 100 // Before a register write
+#define TURTLE_REPORT_GUARD_US 1000 // Before SEND_REPORT, so it is recognised by the turtle
+
+/* Status byte the turtle shifts out on MISO during the first byte of every transaction. Older turtle
+ * firmware doesn't send it, so nothing that lacks the signature is trusted. */
+#define TURTLE_SIGNATURE_MASK 0xE0
+#define TURTLE_SIGNATURE 0xA0
+#define TURTLE_READY 0x10 // Set if the turtle has finished with the last transaction
+#define TURTLE_SEQ_MASK 0x0F // Low bits of the sequence number of the last SEND_REPORT committed
+
+#define TURTLE_GUARD_MARGIN 2 // The calibrated guard time is this many times the shortest that worked
+#define TURTLE_CALIBRATE_TRIES 4 // A guard time has to work this many times in a row
+#define TURTLE_GUARD_DECAY_ACKS 64 // Backed off guard times are halved after this many reports in a row are acknowledged
+
+#define REPORT_FRAME_TRANSACTIONS 5 // Four register writes and SEND_REPORT
+
+/** A complete snapshot of the controller state as seen by the turtle. Each field is written to
+* the turtle register of the same name before a single SEND_REPORT commits them all at once.
+*/
+typedef struct {
+    uint8_t buttons; // BR0
+    uint8_t x; // JSX
+    uint8_t y; // JSY
+    uint8_t dpad; // DPAD
+} ReportFrame;
+
+/** Queues the 'data' byte to be written to the turtle register 'reg' over SPI without sending
+* 'SEND_REPORT'. The change is not pushed to the GamePad until spi_send_report() is called.
 *
-* addr: is the appropriate register macro for UART protocol as per macros.h (e.g. BUTTON, RLED, etc.)
 * reg: is the appropriate register macro for SPI protocol as per macros.h (e.g. BR0, JSX, DPAD, etc.)
-* data: is the data byte to be sent via UART and SPI
+* data: is the data byte to be sent via SPI.
 *
-* This method calls uart_update() and spi_update to send the macro and data bytes over the respective
-* communication platform.
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the write
+* SPI_OK: returned if the write was queued
 */
-void update(char* addr, char reg, char data);
+uint8_t spi_write_register(char reg, char data);
 
-/** Sends the bytes passed to it using UART communication.
+/** Queues 'SEND_REPORT' to tell the turtle to push the current contents of its registers to the
+* GamePad.
 *
-* addr: is the appropriate register macro for UART protocol as per macros.h (e.g. BUTTON, RLED, etc.)
-* data: is the data byte to sent via UART
-* 
-* The message is sent via a printf call of this format:
-*	printf("%s%c\n", addr, data);
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the report
+* SPI_OK: returned if the report was queued
 */
-void uart_update(char* addr, char data);
+uint8_t spi_send_report(void);
 
-/** Updates the GamePad by sending 'reg' and 'data' bytes to turtle followed by 'SEND_REPORT'
-* over SPI.
+/** Updates the GamePad with a full controller snapshot. BR0, JSX, JSY and DPAD are written in one
+* burst and committed with exactly one 'SEND_REPORT', so the GamePad never sees a half updated state.
+* The frame is only queued if all of it fits, and is then sent in the background.
 *
-* reg: is the appropriate register macro for SPI protocol as per macros.h (e.g. BR0, JSX, DPAD, etc.)
-* data: is the data byte to be sent via SPI.
+* frame: the controller snapshot to be sent to the turtle
 *
-* SEND_REPORT must be sent to the turtle in order to actually push the changes to the GamePad.
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the frame, nothing was queued
+* SPI_OK: returned if the frame was queued
 */
-void spi_update(char reg, char data);
+uint8_t spi_update_frame(ReportFrame* frame);
 
-/** Updates the potentiometer wiper values using SPI.
+/** Updates the potentiometer wiper values using SPI. The update is queued and sent in the
+* background, waiting for room in the SPI queue if necessary.
 *
 * w1: the value to be written to wiper 1 of the potentiometer
 * w2: the value to be written to wiper 2 of the potentiometer
 */
 void pot_update(char w1, char w2);
 
+/** Queues a single byte potentiometer command, such as POT_WIPER0_INCREMENT, to be sent 'count'
+* times in one chip select window, so several wiper steps cost one short SPI transaction.
+*
+* command: the command byte (POT_WIPER0_INCREMENT or POT_WIPER0_DECREMENT)
+* count: the number of times to send it (1 - SPI_TRANSACTION_MAX)
+*
+* Returns:
+* SPI_INVALID_LENGTH: returned if count is out of range, nothing was queued
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the command
+* SPI_OK: returned if the command was queued
+*/
+uint8_t pot_step(uint8_t command, uint8_t count);
+
+/** Measures the shortest time SS has to be held high between transactions for the turtle to be
+* ready for the next one, and uses it (with a margin) for every turtle transaction from then on.
+* If the turtle doesn't send status bytes the legacy guard times are kept. Blocks for a few
+* milliseconds, so it is only called once at boot after Timer1 and SPI have been initialised.
+*/
+void turtle_link_calibrate(void);
+
+/** Handles the status byte the turtle sent during the first byte of a transaction. Checks the
+* turtle was ready and has committed the last SEND_REPORT. Called from the SPI ISR.
+*
+* status: the byte received from the turtle
+* command: the first byte of the transaction (a register or SEND_REPORT)
+* arg: the second byte of the transaction (the data or the report sequence number)
+*/
+void turtle_link_status(uint8_t status, uint8_t command, uint8_t arg);
+
+/** Checks whether the turtle has reported being busy or has missed a report since the last call.
+* If it was busy the guard times are doubled, up to the legacy guard times. Once the turtle has
+* acknowledged TURTLE_GUARD_DECAY_ACKS reports in a row they are halved, down to the
+* calibrated guard times.
+*
+* Returns:
+* boolean: true if a report may have been lost and should be sent again, false otherwise
+*/
+uint8_t turtle_link_lost(void);
+
+/** Polls the turtle for the acknowledgement of the last SEND_REPORT once the SPI queue has gone
+* idle, by writing 'buttons' to BR0 again. The write waits for the report guard time so the turtle
+* has had time to commit the report. Does nothing if no acknowledgement is waiting.
+*
+* buttons: the value BR0 was last set to, so the write doesn't change the turtle registers
+*/
+void turtle_link_probe(uint8_t buttons);
+
+/** Returns the guard time currently used before turtle register writes in microseconds */
+uint16_t turtle_register_guard(void);
+
+/** Returns the guard time currently used before SEND_REPORT in microseconds */
+uint16_t turtle_report_guard(void);
+
+/** Reads a 9 bit potentiometer register. Waits for the SPI queue to empty and then does a blocking
+* transfer, so it is only used at boot. Tasks use pot_read_queue() instead.
+*
+* command: the read command for the register (POT_WIPER0_READ or POT_STATUS_READ)
+*
+* Returns:
+* POT_READ_ERROR: returned if the potentiometer flagged the command as invalid
+* value: the 9 bit register value otherwise
+*/
+uint16_t pot_read(uint8_t command);
+
+/** Queues a read of a 9 bit potentiometer register. The read is sent in the background and its
+* result collected with pot_read_result() once it has arrived, so this returns straight away.
+*
+* command: the read command for the register (POT_WIPER0_READ or POT_STATUS_READ)
+*
+* Returns:
+* SPI_QUEUE_FULL: returned if the SPI queue had no room for the read
+* SPI_OK: returned if the read was queued
+*/
+uint8_t pot_read_queue(uint8_t command);
+
+/** Handles a byte received from the potentiometer while a byte of 'command' was sent. Records the
+* result of a read queued by pot_read_queue() once both of its bytes have arrived. Called from the
+* SPI ISR.
+*
+* command: the first byte of the transaction
+* index: the position of the byte in the transaction
+* received: the byte received from the potentiometer
+*/
+void pot_read_byte(uint8_t command, uint8_t index, uint8_t received);
+
+/** Collects the result of the last read queued by pot_read_queue() for a register.
+*
+* command: the read command for the register (POT_WIPER0_READ or POT_STATUS_READ)
+* value: set to the 9 bit register value, or POT_READ_ERROR if the potentiometer flagged the command
+*	as invalid
+*
+* Returns:
+* boolean: true if the read has finished and value has been set, false if it is still waiting
+*/
+uint8_t pot_read_result(uint8_t command, uint16_t* value);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+/*
+**************************************************************************************************************
+* file: crc.h
+* brief: Table driven CRC-8
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __CRC_H__
+#define __CRC_H__
+
+#include <stdint.h>
+
+#define CRC8_INIT 0x00
+
+/** Adds one byte to a running CRC-8 (polynomial 0x07).
+*
+* Variables:
+* crc: the CRC of the bytes so far (CRC8_INIT for the first byte)
+* data: the next byte
+*
+* Returns:
+* crc: the CRC including data
+*/
+uint8_t crc8_update(uint8_t crc, uint8_t data);
+
+/** Calculates the CRC-8 (polynomial 0x07) of a block of bytes.
+*
+* Variables:
+* data: the bytes to check
+* length: the number of bytes in data
+*
+* Returns:
+* crc: the CRC of the bytes
+*/
+uint8_t crc8(const uint8_t* data, uint8_t length);
+
+#endif
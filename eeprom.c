@@ -6,17 +6,50 @@
 **************************************************************************************************************
 */
 
+#include "eeprom.h"
 #include "macros.h"
+#include "stats.h"
+#include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/atomic.h>
 
 /* 
 * EEPROM addr
 * Addresses 0-2 will be for LED colour values (0 - 255)
 * Address 3 will be for the potentiometer wiper value (0 - 255)
 * Address 4 will be for the DPAD emulation variable ('1' or '0')
+* Addresses 5-9 hold the input, report and LED effect settings (see macros.h)
+* Addresses 16-1023 hold the wear leveled settings log (see eeprom_log.c), which has replaced
+* addresses 0-4 for everything but the first boot
 */
 
-/** Reads the data at the address uiAddress and saves it to data.
+/*
+ * Writes are not done straight away. EEPROM_update() adds them to a queue which is drained in the
+ * background by the EEPROM ready interrupt, one byte per ~3.3ms program cycle, so the caller never
+ * waits for the EEPROM. A queued write to an address that already has a write waiting replaces it.
+ * EEPROM_read() returns queued data before it reaches the EEPROM, and each write is verified by
+ * reading it back once it has finished.
+ */
+
+#define EEPROM_QUEUE_MASK (EEPROM_QUEUE_SIZE - 1)
+
+typedef struct {
+    uint16_t addr;
+    uint8_t data;
+} EepromWrite;
+
+static volatile EepromWrite queue[EEPROM_QUEUE_SIZE];
+static volatile uint8_t queueHead; // Position the next write is added at
+static volatile uint8_t queueTail; // Position of the next write to be started
+
+/* The write in progress, checked once it has finished */
+static volatile uint8_t verifyPending;
+static volatile uint16_t verifyAddr;
+static volatile uint8_t verifyData;
+static volatile uint8_t writeFailed; // Set if a write did not verify, cleared by EEPROM_status()
+
+/** Reads the data at the address uiAddress and saves it to data. If a write to the address is
+* still queued the queued data is returned.
 *
 * Variables:
 * uiAddress: the 16 bit address byte of the data (EEPROM addresses range from 0 - 1023)
@@ -31,20 +64,36 @@ uint8_t EEPROM_read(uint16_t uiAddress, uint8_t* data)
     if (uiAddress > EEPROM_SIZE) {
         return EEPROM_INVALID_ADDR;
     }
-    /* Wait for completion of previous write */
-    while (EECR & (1 << EEPE))
-        ;
-    /* Set up address register */
-    EEARH = (uiAddress & 0xFF00) >> 8;
-    EEARL = (uiAddress & 0x00FF);
-    /* Start eeprom read by writing EERE */
-    EECR |= (1 << EERE);
-    /* Return data from Data Register */
-    *data = EEDR;
-    return EEPROM_OK;
+
+    while (1) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            /* Queued writes are newer than the EEPROM contents */
+            for (uint8_t i = queueTail; i != queueHead; i = (i + 1) & EEPROM_QUEUE_MASK) {
+                if (queue[i].addr == uiAddress) {
+                    *data = queue[i].data;
+                    return EEPROM_OK;
+                }
+            }
+
+            /* Wait for completion of previous write with interrupts enabled */
+            if (!(EECR & (1 << EEPE))) {
+                /* Set up address register */
+                EEARH = (uiAddress & 0xFF00) >> 8;
+                EEARL = (uiAddress & 0x00FF);
+                /* Start eeprom read by writing EERE */
+                EECR |= (1 << EERE);
+                /* Return data from Data Register */
+                *data = EEDR;
+                return EEPROM_OK;
+            }
+        }
+    }
 }
 
-/** Writes the byte ucData to the memory at the address uiAddress.
+/** Queues the byte ucData to be written to the address uiAddress. The write is done in the
+* background by the EEPROM ready interrupt, and is skipped if the EEPROM already holds ucData.
+* Waits for room if the queue is full, so must be called with interrupts enabled.
 *
 * Variables:
 * uiAddress: the 16 bit address byte of the data (EEPROM addresses range from 0 - 1023)
@@ -52,75 +101,120 @@ uint8_t EEPROM_read(uint16_t uiAddress, uint8_t* data)
 *
 * Returns:
 * EEPROM_INVALID_ADDR: returned if the address is out of bounds (greater than 1023)
-* EEPROM_OK: returned if the write was successful.
+* EEPROM_OK: returned if the write was queued
 */
-uint8_t EEPROM_write(uint16_t uiAddress, uint8_t ucData)
+uint8_t EEPROM_update(uint16_t uiAddress, uint8_t ucData)
 {
     if (uiAddress > EEPROM_SIZE) {
         return EEPROM_INVALID_ADDR;
     }
 
-    /* Wait for completion of previous write */
-    while (EECR & (1 << EEPE))
-        ;
-    /* Set up address and Data Registers */
-    EEARH = (uiAddress & 0xFF00) >> 8;
-    EEARL = (uiAddress & 0x00FF);
-    //EEAR = uiAddress;
-    EEDR = ucData;
-    /* Write logical one to EEMPE */
-    EECR |= (1 << EEMPE);
-    /* Start eeprom write by setting EEPE */
-    EECR |= (1 << EEPE);
-
-    return EEPROM_OK;
+    while (1) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            /* Replace a write to the same address that hasn't been started yet */
+            for (uint8_t i = queueTail; i != queueHead; i = (i + 1) & EEPROM_QUEUE_MASK) {
+                if (queue[i].addr == uiAddress) {
+                    queue[i].data = ucData;
+                    return EEPROM_OK;
+                }
+            }
+
+            /* One slot is kept free to tell a full queue from an empty one */
+            if (((queueHead + 1) & EEPROM_QUEUE_MASK) != queueTail) {
+                queue[queueHead].addr = uiAddress;
+                queue[queueHead].data = ucData;
+                queueHead = (queueHead + 1) & EEPROM_QUEUE_MASK;
+
+                /* Let the EEPROM ready interrupt drain the queue */
+                EECR |= (1 << EERIE);
+                return EEPROM_OK;
+            }
+        }
+    }
 }
 
-/** Updates the data at the given address only if the data at the address if different from 
-* the ucData. This is to minimise the number of writes to EEPROM. 
-*	
-* Variables:
-* uiAddress: the 16 bit address byte of the data (EEPROM addresses range from 0 - 1023)
-* ucData: the data byte to be written to the memory location
-* 
+/** Returns the number of writes that can be queued without EEPROM_update() having to wait */
+uint8_t EEPROM_queue_space(void)
+{
+    /* One slot is kept free to tell a full queue from an empty one */
+    return EEPROM_QUEUE_MASK - ((queueHead - queueTail) & EEPROM_QUEUE_MASK);
+}
+
+/** Blocks until every queued write has been written to EEPROM and verified. Must be called with
+* interrupts enabled.
+*
 * Returns:
-* EEPROM_INVALID_ADDR: returned if the address is out of bounds (greater than 1023)
-* EEPROM_WRITE_FAIL: returned if the write failed
-* EEPROM_OK: returned if the write was successful or no write was needed
+* EEPROM_WRITE_FAIL: returned if any write failed since the last call to EEPROM_status()
+* EEPROM_OK: returned if every write was successful
 */
-uint8_t EEPROM_update(uint16_t uiAddress, uint8_t ucData)
+uint8_t EEPROM_flush(void)
 {
-    uint8_t err = EEPROM_OK;
+    /* The interrupt turns itself off once the queue is empty and the last write is verified */
+    while (EECR & (1 << EERIE))
+        ;
 
-    if (uiAddress > EEPROM_SIZE) {
-        return EEPROM_INVALID_ADDR;
-    }
+    return writeFailed ? EEPROM_WRITE_FAIL : EEPROM_OK;
+}
 
-    uint8_t value = 0;
+/** Checks whether any background write has failed to verify, without waiting. Clears the failure so
+* each one is only seen once.
+*
+* Returns:
+* EEPROM_WRITE_FAIL: returned if any write failed since the last call to EEPROM_status()
+* EEPROM_OK: returned if every finished write was successful
+*/
+uint8_t EEPROM_status(void)
+{
+    uint8_t err = writeFailed ? EEPROM_WRITE_FAIL : EEPROM_OK;
 
-    err = EEPROM_read(uiAddress, &value);
-    if (err != EEPROM_OK) {
-        return err;
-    }
-    /* Checking the value at the addr is different from the ucData value to reduce the number of */
-    /* unnecessary writes. */
-    if (value == ucData) {
-        return EEPROM_OK;
-    }
+    writeFailed = 0;
+    return err;
+}
 
-    err = EEPROM_write(uiAddress, ucData);
-    if (err != EEPROM_OK) { // Checking it actually attempted to write.
-        return err;
+/** EEPROM Ready ISR.
+*
+* Fires whenever the EEPROM is not busy. Checks the write that just finished, then starts the next
+* queued write that actually changes the EEPROM contents. Turns itself off once there is nothing
+* left to do.
+*/
+ISR(EE_READY_vect)
+{
+    if (verifyPending) {
+        EEAR = verifyAddr;
+        EECR |= (1 << EERE);
+        if (EEDR != verifyData) {
+            writeFailed = 1;
+            STATS_COUNT(eepromVerifyFails);
+        }
+        verifyPending = 0;
     }
 
-    err = EEPROM_read(uiAddress, &value); // Checking that the above write was actually successful.
-    if (err != EEPROM_OK) {
-        return err;
-    }
+    while (queueTail != queueHead) {
+        uint16_t addr = queue[queueTail].addr;
+        uint8_t data = queue[queueTail].data;
+        queueTail = (queueTail + 1) & EEPROM_QUEUE_MASK;
+
+        /* Checking the value at the addr is different from the data value to reduce the number of */
+        /* unnecessary writes. */
+        EEAR = addr;
+        EECR |= (1 << EERE);
+        if (EEDR == data) {
+            continue;
+        }
+
+        EEDR = data;
+        /* Write logical one to EEMPE */
+        EECR |= (1 << EEMPE);
+        /* Start eeprom write by setting EEPE */
+        EECR |= (1 << EEPE);
 
-    if (value != ucData) {
-        return EEPROM_WRITE_FAIL;
+        verifyAddr = addr;
+        verifyData = data;
+        verifyPending = 1;
+        STATS_COUNT(eepromWrites);
+        return;
     }
 
-    return EEPROM_OK;
+    EECR &= ~(1 << EERIE);
 }
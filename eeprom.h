@@ -9,8 +9,14 @@
 #ifndef __EEPROM_H__
 #define __EEPROM_H__
 
-/** Updates the data at the given address only if the data at the address if different from
-* the ucData. This is to minimise the number of writes to EEPROM.
+#include <stdint.h>
+
+#define EEPROM_QUEUE_SIZE 16 // Number of writes that can be waiting, must be a power of 2
+
+/** Queues the byte ucData to be written to the address uiAddress. The write is done in the
+* background by the EEPROM ready interrupt, and is skipped if the EEPROM already holds ucData.
+* This is to minimise the number of writes to EEPROM. Waits for room if the queue is full, so must
+* be called with interrupts enabled.
 *
 * Variables:
 * uiAddress: the 16 bit address byte of the data (EEPROM addresses range from 0 - 1023)
@@ -18,12 +24,12 @@
 *
 * Returns:
 * EEPROM_INVALID_ADDR: returned if the address is out of bounds (greater than 1023)
-* EEPROM_WRITE_FAIL: returned if the write failed
-* EEPROM_OK: returned if the write was successful or no write was needed
+* EEPROM_OK: returned if the write was queued
 */
 uint8_t EEPROM_update(uint16_t uiAddress, uint8_t ucData);
 
-/** Reads the data at the address uiAddress and saves it to data.
+/** Reads the data at the address uiAddress and saves it to data. If a write to the address is
+* still queued the queued data is returned.
 *
 * Variables:
 * uiAddress: the 16 bit address byte of the data (EEPROM addresses range from 0 - 1023)
@@ -35,4 +41,25 @@ uint8_t EEPROM_update(uint16_t uiAddress, uint8_t ucData);
 */
 uint8_t EEPROM_read(uint16_t uiAddress, uint8_t* data);
 
-#endif
\ No newline at end of file
+/** Returns the number of writes that can be queued without EEPROM_update() having to wait */
+uint8_t EEPROM_queue_space(void);
+
+/** Blocks until every queued write has been written to EEPROM and verified. Must be called with
+* interrupts enabled.
+*
+* Returns:
+* EEPROM_WRITE_FAIL: returned if any write failed since the last call to EEPROM_status()
+* EEPROM_OK: returned if every write was successful
+*/
+uint8_t EEPROM_flush(void);
+
+/** Checks whether any background write has failed to verify, without waiting. Clears the failure so
+* each one is only seen once.
+*
+* Returns:
+* EEPROM_WRITE_FAIL: returned if any write failed since the last call to EEPROM_status()
+* EEPROM_OK: returned if every finished write was successful
+*/
+uint8_t EEPROM_status(void);
+
+#endif
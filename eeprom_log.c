@@ -0,0 +1,149 @@
+/*
+**************************************************************************************************************
+* file: eeprom_log.c
+* brief: Wear leveled settings log in EEPROM
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "eeprom_log.h"
+#include "crc.h"
+#include "eeprom.h"
+
+/*
+ * Each change to the settings is written as a new record in the next slot of a ring of LOG_SLOTS
+ * slots, so the writes are spread evenly over the unused EEPROM instead of landing on the same
+ * cells every time. A record is laid out as:
+ *
+ *	byte 0 - 1: sequence number (low byte first), one more than the previous record
+ *	byte 2 - 6: ledRed, ledGreen, ledBlue, volume, emMode
+ *	byte 7: inverted CRC-8 of bytes 0 - 6, so blank (0xFF) and zeroed slots are never valid
+ *
+ * Slots are always written in order, so slots 0 to newest hold sequence numbers counting up from
+ * the one in slot 0 and every later slot is blank, torn or left over from the previous pass. That
+ * makes the newest record easy to find with a binary search.
+ */
+
+#define LOG_CRC_BYTE (LOG_RECORD_SIZE - 1)
+
+static uint8_t logNewest = LOG_SLOTS - 1; // Slot of the newest record, the first write goes to 0
+static uint16_t logSeq = 0xFFFF; // Sequence number of the newest record, the first write uses 0
+
+/** Reads the record in a slot and checks it.
+*
+* Variables:
+* slot: the slot to read
+* buffer: LOG_RECORD_SIZE bytes to store the record in
+*
+* Returns:
+* boolean: true if the record is valid, false otherwise
+*/
+static uint8_t log_read_slot(uint8_t slot, uint8_t* buffer)
+{
+    uint16_t addr = LOG_START_ADDR + (uint16_t)slot * LOG_RECORD_SIZE;
+
+    for (uint8_t i = 0; i < LOG_RECORD_SIZE; i++) {
+        EEPROM_read(addr + i, &buffer[i]);
+    }
+    return buffer[LOG_CRC_BYTE] == (uint8_t)~crc8(buffer, LOG_CRC_BYTE);
+}
+
+/** Returns the sequence number of a record read by log_read_slot() */
+static uint16_t log_seq(uint8_t* buffer)
+{
+    return buffer[0] | ((uint16_t)buffer[1] << 8);
+}
+
+/** Finds the newest valid record in the log. Uses a binary search over the slots, so only
+* about log2(LOG_SLOTS) records are read. Must be called once at boot before log_write().
+*
+* Variables:
+* record: pointer to the record to store the newest record in
+*
+* Returns:
+* boolean: true if a record was found, false if the log is empty
+*/
+uint8_t log_recover(LogRecord* record)
+{
+    uint8_t buffer[LOG_RECORD_SIZE];
+    uint8_t newest;
+
+    if (!log_read_slot(0, buffer)) {
+        /* Slot 0 is either blank or was being rewritten when the power went after the log wrapped,
+         * in which case the last slot holds the newest record. */
+        if (!log_read_slot(LOG_SLOTS - 1, buffer)) {
+            return 0;
+        }
+        newest = LOG_SLOTS - 1;
+    } else {
+        uint16_t firstSeq = log_seq(buffer);
+        uint8_t low = 0; // Always a slot in the current pass
+        uint8_t high = LOG_SLOTS - 1;
+
+        while (low < high) {
+            uint8_t mid = (low + high + 1) / 2;
+            if (log_read_slot(mid, buffer) && (uint16_t)(log_seq(buffer) - firstSeq) == mid) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        newest = low;
+        log_read_slot(newest, buffer);
+    }
+
+    logNewest = newest;
+    logSeq = log_seq(buffer);
+    record->ledRed = buffer[2];
+    record->ledGreen = buffer[3];
+    record->ledBlue = buffer[4];
+    record->volume = buffer[5];
+    record->emMode = buffer[6];
+    return 1;
+}
+
+/** Appends a record to the log in the slot after the newest one, wrapping around to the first slot
+* at the end of the log. The record is written in the background using EEPROM_update(), CRC last so
+* a record cut short by a power loss is never valid.
+*
+* Variables:
+* record: the record to write
+*/
+void log_write(LogRecord* record)
+{
+    uint8_t buffer[LOG_RECORD_SIZE];
+
+    logNewest = (logNewest + 1 == LOG_SLOTS) ? 0 : logNewest + 1;
+    logSeq++;
+
+    buffer[0] = logSeq & 0xFF;
+    buffer[1] = logSeq >> 8;
+    buffer[2] = record->ledRed;
+    buffer[3] = record->ledGreen;
+    buffer[4] = record->ledBlue;
+    buffer[5] = record->volume;
+    buffer[6] = record->emMode;
+    buffer[LOG_CRC_BYTE] = ~crc8(buffer, LOG_CRC_BYTE);
+
+    uint16_t addr = LOG_START_ADDR + (uint16_t)logNewest * LOG_RECORD_SIZE;
+    for (uint8_t i = 0; i < LOG_RECORD_SIZE; i++) {
+        EEPROM_update(addr + i, buffer[i]);
+    }
+}
+
+/** Returns the number of records written to the log over the life of the EEPROM (modulo 65536) */
+uint16_t log_records_written(void)
+{
+    return logSeq + 1;
+}
+
+/** Returns the number of times the most worn log cell has been written. Without the log every
+* record would have been written to the same cells, so this is log_records_written() divided by
+* LOG_SLOTS.
+*/
+uint16_t log_cell_writes(void)
+{
+    uint16_t records = log_records_written();
+
+    return records / LOG_SLOTS + (records % LOG_SLOTS != 0);
+}
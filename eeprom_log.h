@@ -0,0 +1,57 @@
+/*
+**************************************************************************************************************
+* file: eeprom_log.h
+* brief: Wear leveled settings log in EEPROM
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __EEPROM_LOG_H__
+#define __EEPROM_LOG_H__
+
+#include "macros.h"
+#include <stdint.h>
+
+/* The log fills the EEPROM after the fixed settings addresses */
+#define LOG_START_ADDR 0x0010
+#define LOG_RECORD_SIZE 8
+#define LOG_SLOTS ((EEPROM_SIZE + 1 - LOG_START_ADDR) / LOG_RECORD_SIZE)
+
+/** The frequently changed settings kept in the log */
+typedef struct {
+    uint8_t ledRed;
+    uint8_t ledGreen;
+    uint8_t ledBlue;
+    uint8_t volume;
+    uint8_t emMode;
+} LogRecord;
+
+/** Finds the newest valid record in the log. Uses a binary search over the slots, so only
+* about log2(LOG_SLOTS) records are read. Must be called once at boot before log_write().
+*
+* Variables:
+* record: pointer to the record to store the newest record in
+*
+* Returns:
+* boolean: true if a record was found, false if the log is empty
+*/
+uint8_t log_recover(LogRecord* record);
+
+/** Appends a record to the log in the slot after the newest one, wrapping around to the first slot
+* at the end of the log. The record is written in the background using EEPROM_update().
+*
+* Variables:
+* record: the record to write
+*/
+void log_write(LogRecord* record);
+
+/** Returns the number of records written to the log over the life of the EEPROM (modulo 65536) */
+uint16_t log_records_written(void);
+
+/** Returns the number of times the most worn log cell has been written. Without the log every
+* record would have been written to the same cells, so this is log_records_written() divided by
+* LOG_SLOTS.
+*/
+uint16_t log_cell_writes(void);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+**************************************************************************************************************
+* file: frame.c
+* brief: Binary frames for the GUI link
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "frame.h"
+#include "crc.h"
+
+/** Wraps a payload in a frame.
+*
+* Variables:
+* frame: FRAME_MAX bytes to store the frame in
+* payload: the fields to send
+* length: the number of bytes in payload (up to FRAME_MAX_PAYLOAD)
+*
+* Returns:
+* length: the number of bytes in the frame
+*/
+uint8_t frame_encode(uint8_t* frame, const uint8_t* payload, uint8_t length)
+{
+    uint8_t crc = crc8_update(CRC8_INIT, length);
+
+    frame[0] = FRAME_SYNC;
+    frame[1] = length;
+    for (uint8_t i = 0; i < length; i++) {
+        frame[2 + i] = payload[i];
+        crc = crc8_update(crc, payload[i]);
+    }
+    frame[2 + length] = crc;
+    return length + FRAME_OVERHEAD;
+}
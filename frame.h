@@ -0,0 +1,40 @@
+/*
+**************************************************************************************************************
+* file: frame.h
+* brief: Binary frames for the GUI link
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stdint.h>
+
+/*
+ * A binary frame is laid out as:
+ *
+ *	FRAME_SYNC, payload length, payload, CRC-8 of the length and payload bytes
+ *
+ * The payload is a list of fields, each a type byte followed by its value. The type bytes are the
+ * same letters as the text protocol (see macros.h) and the length of each value is fixed by its
+ * type: telemetry fields are one byte, query replies are 16 bit little endian values.
+ */
+#define FRAME_SYNC 0xA5
+#define FRAME_MAX_PAYLOAD 16
+#define FRAME_OVERHEAD 3 // Sync, length and CRC
+#define FRAME_MAX (FRAME_MAX_PAYLOAD + FRAME_OVERHEAD)
+
+/** Wraps a payload in a frame.
+*
+* Variables:
+* frame: FRAME_MAX bytes to store the frame in
+* payload: the fields to send
+* length: the number of bytes in payload (up to FRAME_MAX_PAYLOAD)
+*
+* Returns:
+* length: the number of bytes in the frame
+*/
+uint8_t frame_encode(uint8_t* frame, const uint8_t* payload, uint8_t length);
+
+#endif
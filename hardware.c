@@ -7,14 +7,40 @@
 */
 
 #include "hardware.h"
+#include "latency.h"
+#include "led.h"
 #include "memory.h"
+#include <util/atomic.h>
 
-int countJoystick = 0;
-int countButtons = 0;
-int countJoystickX = 0;
-int countJoystickY = 0;
+static volatile uint16_t inputState = 0; // Debounced input state published by input_scan()
 
-/** Sets the duty cycle variables for the LEDs and saves them to EEPROM.
+/* Vertical counters, one 3 bit counter per input line with bit n of every line stored in countn */
+static uint16_t count0 = 0;
+static uint16_t count1 = 0;
+static uint16_t count2 = 0;
+
+/* Debounce windows, and the same windows spread out as vertical counter bit planes. Bit plane n is
+ * all ones if bit n of the window is set, so a whole window can be compared against the counters. */
+static uint8_t debouncePress = INPUT_DEBOUNCE_PRESS_DEFAULT;
+static uint8_t debounceRelease = INPUT_DEBOUNCE_RELEASE_DEFAULT;
+static uint8_t eagerPress = 0; // True if the pin change ISR publishes presses
+static uint16_t pressPlane[3] = { 0xFFFF, 0xFFFF, 0x0000 };
+static uint16_t releasePlane[3] = { 0xFFFF, 0x0000, 0xFFFF };
+
+/* Lines released by the debouncer that the pin change ISR must not publish as presses yet, because
+ * their contacts may still be bouncing. Each has its own vertical counter holding the number of
+ * samples in a row it has read released, and it leaves the hold off once that reaches the press window. */
+static uint16_t releaseHoldoff = 0;
+static uint16_t hold0 = 0;
+static uint16_t hold1 = 0;
+static uint16_t hold2 = 0;
+
+/* Duty cycles waiting to be loaded into the output compare registers, already inverted */
+static volatile uint8_t dutyCycleRed = 255;
+static volatile uint8_t dutyCycleGreen = 255;
+static volatile uint8_t dutyCycleBlue = 255;
+
+/** Fades the LEDs to a new colour and saves it to EEPROM.
 *
 * Variables:
 * red: duty cycle for the red colour of the LEDs
@@ -23,9 +49,47 @@ int countJoystickY = 0;
 */
 void set_duty_cycles(uint8_t red, uint8_t green, uint8_t blue)
 {
+    led_fade_to(red, green, blue);
     save_duty_cycles(red, green, blue);
 }
 
+/** Changes the LED colour. The new duty cycles are loaded into the output compare registers by the
+* timer overflow interrupts at the bottom of the next PWM period, which are only turned on while a
+* change is waiting. Doesn't save the colour.
+*
+* Variables:
+* red: duty cycle for the red colour of the LEDs
+* green: duty cycle for the green colour of the LEDs
+* blue: duty cycle for the blue colour of the LEDs
+*/
+void rgb_led_set(uint8_t red, uint8_t green, uint8_t blue)
+{
+    /* The outputs are active low */
+    red = 255 - red;
+    green = 255 - green;
+    blue = 255 - blue;
+
+    /* The interrupts are only turned on after every value is written, so however they interleave
+     * with this the last values written are the ones that end up loaded */
+    if (red != dutyCycleRed || green != dutyCycleGreen) {
+        dutyCycleRed = red;
+        dutyCycleGreen = green;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            TIFR0 = (1 << TOV0);
+            TIMSK0 |= (1 << TOIE0);
+        }
+    }
+    if (blue != dutyCycleBlue) {
+        dutyCycleBlue = blue;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            TIFR2 = (1 << TOV2);
+            TIMSK2 |= (1 << TOIE2);
+        }
+    }
+}
+
 /** Set GPIO pins for RGB LEDs */
 void rgb_led_init(void)
 {
@@ -40,14 +104,14 @@ void rgb_led_PWM_init(void)
     TCCR0A = (1 << COM0A1) | (1 << COM0B1) | (1 << WGM00) | (1 << WGM01);
     TCCR2A = (1 << COM2B1) | (1 << WGM20) | (1 << WGM21);
 
-    /* Set overflow interrupt */
-    TIMSK0 = (1 << TOIE0);
-    TIMSK2 = (1 << TOIE2);
+    /* Overflow interrupts are only turned on by rgb_led_set() while a colour change is waiting */
+    TIMSK0 = 0;
+    TIMSK2 = 0;
 
-    /* Set output compare registers */
-    OCR0A = (0 / 100) * 255;
-    OCR2B = (0 / 100) * 255;
-    OCR0B = (0 / 100) * 255;
+    /* Set output compare registers, LEDs off */
+    OCR0A = dutyCycleRed;
+    OCR2B = dutyCycleBlue;
+    OCR0B = dutyCycleGreen;
 
     /* Start timers, no prescalar */
     TCCR0B = (1 << CS01);
@@ -74,59 +138,212 @@ void button_init_2(void)
     PORTB |= ((1 << PORTB1));
 }
 
-/** Poll the joystick X controls for pins: PD4, PD7
+/** Reads the button and joystick pins.
 *
 * Returns:
-*	joystick: the current state of the joysticks X position 0 for 0, 7 for +X, and 10 for -X.
+* sample: the raw state of the inputs laid out as the input state word
 */
-int poll_joystick_x(void)
+static uint16_t input_sample(void)
 {
-    int joystickX = 0;
+    /* All inputs are active low */
+    uint8_t pinb = ~PINB;
+    uint8_t pinc = ~PINC;
+    uint8_t pind = ~PIND;
+    uint16_t sample = pinc & ((1 << PINC0) | (1 << PINC1) | (1 << PINC2) | (1 << PINC3) | (1 << PINC4) | (1 << PINC5));
 
-    if (!((PIND & (1 << PIND4)) == (1 << PIND4))) { // POSITIVE X
-        joystickX = 7;
-        countJoystickX++;
+    if (pinb & (1 << PINB1)) {
+        sample |= (1 << 6);
+    }
+    if (pind & (1 << PIND4)) {
+        sample |= (1 << INPUT_X_POS);
+    }
+    if (pind & (1 << PIND7)) {
+        sample |= (1 << INPUT_X_NEG);
     }
-    if (!((PIND & (1 << PIND7)) == (1 << PIND7))) { // NEGATIVE X
-        joystickX = 10;
-        countJoystickY++;
+    if (pinb & (1 << PINB6)) {
+        sample |= (1 << INPUT_Y_POS);
+    }
+    if (pinb & (1 << PINB7)) {
+        sample |= (1 << INPUT_Y_NEG);
+    }
+
+    return sample;
+}
+
+/** Samples the button and joystick pins and debounces them. Called from the system tick ISR, so
+* the inputs are sampled at a fixed rate of one sample per tick.
+*
+* Every line has a 3 bit vertical counter holding the number of samples in a row it has differed
+* from its debounced state. All 11 lines are counted and compared against their press or release
+* window at once, so the cost is the same no matter how many lines change.
+*/
+void input_scan(void)
+{
+    uint16_t sample = input_sample();
+    uint16_t state = inputState;
+    uint16_t delta = sample ^ state;
+
+    /* Count up the lines that differ from their debounced state, clear the ones that agree */
+    count2 = (count2 ^ (count1 & count0)) & delta;
+    count1 = (count1 ^ count0) & delta;
+    count0 = ~count0 & delta;
+
+    /* Released lines are compared against the press window and pressed lines against the
+     * release window. Lines whose count has reached their window toggle. */
+    uint16_t toggle = delta
+        & ~((count0 ^ ((pressPlane[0] & ~state) | (releasePlane[0] & state)))
+            | (count1 ^ ((pressPlane[1] & ~state) | (releasePlane[1] & state)))
+            | (count2 ^ ((pressPlane[2] & ~state) | (releasePlane[2] & state))));
+
+    count0 &= ~toggle;
+    count1 &= ~toggle;
+    count2 &= ~toggle;
+    inputState = state ^ toggle;
+
+    /* Count how long held off lines have read released, a bounce starts the count again */
+    uint16_t quiet = releaseHoldoff & ~sample;
+    hold2 = (hold2 ^ (hold1 & hold0)) & quiet;
+    hold1 = (hold1 ^ hold0) & quiet;
+    hold0 = ~hold0 & quiet;
+    uint16_t settled = quiet & ~((hold0 ^ pressPlane[0]) | (hold1 ^ pressPlane[1]) | (hold2 ^ pressPlane[2]));
+
+    /* Lines that have just been released are held off, from a count of zero */
+    uint16_t released = toggle & state;
+    releaseHoldoff = (releaseHoldoff & ~settled) | released;
+    hold0 &= ~released;
+    hold1 &= ~released;
+    hold2 &= ~released;
+
+    if (toggle) {
+        latency_input();
     }
+}
 
-    _delay_ms(1);
+/** Sets the debounce windows used by input_scan(). Values outside 1 - INPUT_DEBOUNCE_MAX leave
+* the current window unchanged.
+*
+* Variables:
+* press: number of samples a press must be stable for before it is accepted
+* release: number of samples a release must be stable for before it is accepted
+*/
+void input_set_debounce(uint8_t press, uint8_t release)
+{
+    if (press >= 1 && press <= INPUT_DEBOUNCE_MAX) {
+        debouncePress = press;
+    }
+    if (release >= 1 && release <= INPUT_DEBOUNCE_MAX) {
+        debounceRelease = release;
+    }
 
-    if (countJoystickX == 12) {
-        return joystickX;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (uint8_t i = 0; i < 3; i++) {
+            pressPlane[i] = (debouncePress & (1 << i)) ? 0xFFFF : 0x0000;
+            releasePlane[i] = (debounceRelease & (1 << i)) ? 0xFFFF : 0x0000;
+        }
     }
 }
 
-/** Poll the joystick Y controls for pins: PB6, PB7
+/** Sets the debounce windows and saves them to EEPROM. Values outside 1 - INPUT_DEBOUNCE_MAX
+* leave the current window unchanged.
+*
+* Variables:
+* press: number of samples a press must be stable for before it is accepted
+* release: number of samples a release must be stable for before it is accepted
+*/
+void set_debounce(uint8_t press, uint8_t release)
+{
+    input_set_debounce(press, release);
+    save_debounce(debouncePress, debounceRelease);
+}
+
+/** Turns eager press mode on or off. In eager press mode the pin change interrupts on ports B, C
+* and D publish a press as soon as the first falling edge is seen, instead of waiting for the
+* debouncer. Releases are still confirmed by the debouncer.
+* The pin change interrupts are turned on either way so that touching the controller wakes the CPU
+* from idle sleep.
+*
+* Variables:
+* enable: true to turn eager press mode on, false to turn it off
+*/
+void input_set_eager(uint8_t enable)
+{
+    /* Every button and joystick pin set up by button_init_2() and joystick_init_2() */
+    PCMSK0 = (1 << PCINT1) | (1 << PCINT6) | (1 << PCINT7);
+    PCMSK1 = (1 << PCINT8) | (1 << PCINT9) | (1 << PCINT10) | (1 << PCINT11) | (1 << PCINT12) | (1 << PCINT13);
+    PCMSK2 = (1 << PCINT20) | (1 << PCINT23);
+
+    eagerPress = enable;
+    PCIFR = (1 << PCIF0) | (1 << PCIF1) | (1 << PCIF2);
+    PCICR = (1 << PCIE0) | (1 << PCIE1) | (1 << PCIE2);
+}
+
+/** Sets the eager press mode and saves it to EEPROM.
+*
+* Variables:
+* eager: the eager press mode, '1' for on and anything else for off
+*/
+void set_eager_press(uint8_t eager)
+{
+    input_set_eager(eager == '1');
+    save_eager_mode(eager);
+}
+
+/** Reads the latest debounced input state without blocking.
 *
 * Returns:
-* joystick: the current state of the joysticks Y position 0 for 0, 8 for +Y, and 9 for -Y.
+* state: the input state word, see the INPUT_ macros for the meaning of each bit
 */
-int poll_joystick_y(void)
+uint16_t input_state(void)
 {
-    int joystickY = 0;
+    uint16_t state;
 
-    if (!((PINB & (1 << PINB6)) == (1 << PINB6))) { // POSITIVE Y
-        joystickY = 8;
-        countJoystickX++;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        state = inputState;
     }
-    if (!((PINB & (1 << PINB7)) == (1 << PINB7))) { // NEGATIVE Y
-        joystickY = 9;
-        countJoystickY++;
+    return state;
+}
+
+/** Poll the joystick X controls for pins: PD4, PD7
+*
+* Returns:
+*	joystick: the current state of the joysticks X position 0 for 0, 7 for +X, and 10 for -X.
+*/
+int poll_joystick_x(void)
+{
+    uint16_t state = input_state();
+
+    if (state & (1 << INPUT_X_NEG)) { // NEGATIVE X
+        return 10;
+    }
+    if (state & (1 << INPUT_X_POS)) { // POSITIVE X
+        return 7;
     }
+    return 0;
+}
 
-    _delay_ms(1);
+/** Poll the joystick Y controls for pins: PB6, PB7
+*
+* Returns:
+* joystick: the current state of the joysticks Y position 0 for 0, 8 for +Y, and 9 for -Y.
+*/
+int poll_joystick_y(void)
+{
+    uint16_t state = input_state();
 
-    if (countJoystickY == 12) {
-        return joystickY;
+    if (state & (1 << INPUT_Y_NEG)) { // NEGATIVE Y
+        return 9;
     }
+    if (state & (1 << INPUT_Y_POS)) { // POSITIVE Y
+        return 8;
+    }
+    return 0;
 }
 
 /** Poll the input pins for the buttons
 * 
-* Checks the state of each pin. If a pin is low (button pressed) a 1 is bit shifted into 
+* Reads the debounced state of each button. If a button is pressed a 1 is bit shifted into
 * buttonsPressed by the number corresponding to the button pressed. E.g. 0b00000010 means
 * button 2 on the controller has been pressed.
 *
@@ -136,41 +353,55 @@ int poll_joystick_y(void)
 */
 int poll_button_press(void)
 {
+    return input_state() & INPUT_BUTTONS_MASK;
+}
 
-    char buttonsPressed = 0x00;
-
-    if (!((PINC & (1 << PINC0)) == (1 << PINC0))) {
-        countButtons++;
-        buttonsPressed |= (1 << 0);
-    }
-    if (!((PINC & (1 << PINC1)) == (1 << PINC1))) {
-        countButtons++;
-        buttonsPressed |= (1 << 1);
-    }
-    if (!((PINC & (1 << PINC2)) == (1 << PINC2))) {
-        countButtons++;
-        buttonsPressed |= (1 << 2);
-    }
-    if (!((PINC & (1 << PINC3)) == (1 << PINC3))) {
-        countButtons++;
-        buttonsPressed |= (1 << 3);
-    }
-    if (!((PINC & (1 << PINC4)) == (1 << PINC4))) {
-        countButtons++;
-        buttonsPressed |= (1 << 4);
-    }
-    if (!((PINC & (1 << PINC5)) == (1 << PINC5))) {
-        countButtons++;
-        buttonsPressed |= (1 << 5);
-    }
-    if (!((PINB & (1 << PINB1)) == (1 << PINB1))) {
-        countButtons++;
-        buttonsPressed |= (1 << 6);
+/** Pin Change ISR for ports B, C and D.
+*
+* Wakes the CPU from idle sleep. In eager press mode it also publishes any line that has just been
+* pressed straight away and restarts its debounce count, so the debouncer then has to see a full
+* release window before the press can be released again. Lines still held off after a release are
+* left to the debouncer, so the contacts bouncing open are not seen as new presses.
+*/
+ISR(PCINT0_vect)
+{
+    if (!eagerPress) {
+        return;
     }
 
-    _delay_ms(1);
+    uint16_t pressed = input_sample() & ~inputState & ~releaseHoldoff;
 
-    if (countButtons == 12) {
-        return buttonsPressed;
+    if (pressed) {
+        count0 &= ~pressed;
+        count1 &= ~pressed;
+        count2 &= ~pressed;
+        inputState |= pressed;
+        latency_input();
     }
-}
\ No newline at end of file
+}
+
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+
+/** Timer 0 Overflow ISR.
+*
+* Loads the waiting red and green duty cycles at the bottom of the PWM period, then turns itself off
+* until the colour changes again.
+*/
+ISR(TIMER0_OVF_vect)
+{
+    OCR0A = dutyCycleRed;
+    OCR0B = dutyCycleGreen;
+    TIMSK0 &= ~(1 << TOIE0);
+}
+
+/** Timer 2 Overflow ISR.
+*
+* Loads the waiting blue duty cycle at the bottom of the PWM period, then turns itself off until
+* the colour changes again.
+*/
+ISR(TIMER2_OVF_vect)
+{
+    OCR2B = dutyCycleBlue;
+    TIMSK2 &= ~(1 << TOIE2);
+}
@@ -21,9 +21,18 @@
 #define JOYSTICK_PORTD_BITMASK ((1 << PIND4) | (1 << PIND7))
 #define JOYSTICK_PORTB_BITMASK ((1 << PINB7) | (1 << PINB6))
 
-static volatile uint8_t dutyCycleRed = 0;
-static volatile uint8_t dutyCycleGreen = 0;
-static volatile uint8_t dutyCycleBlue = 0;
+/* Bits of the input state word, a set bit means the input is active (pin pulled low) */
+#define INPUT_BUTTONS_MASK 0x007F // Bits 0 - 6 are the buttons in BR0 order: PC0 - PC5, PB1
+#define INPUT_X_POS 8 // PD4
+#define INPUT_X_NEG 9 // PD7
+#define INPUT_Y_POS 10 // PB6
+#define INPUT_Y_NEG 11 // PB7
+
+/* Debounce windows, the number of samples in a row a line must differ from its debounced state
+ * before the change is accepted. Presses and releases have separate windows. */
+#define INPUT_DEBOUNCE_MAX 7 // Limited by the 3 bit vertical counters
+#define INPUT_DEBOUNCE_PRESS_DEFAULT 3
+#define INPUT_DEBOUNCE_RELEASE_DEFAULT 5
 
 /** Set GPIO pins for RGB LEDs */
 void rgb_led_init(void);
@@ -31,7 +40,18 @@ void rgb_led_init(void);
 /*Initialise and control PWM for rgb LEDs*/
 void rgb_led_PWM_init(void);
 
-/** Sets the duty cycle variables for the LEDs and saves them to EEPROM.
+/** Changes the LED colour. The new duty cycles are loaded into the output compare registers by the
+* timer overflow interrupts at the bottom of the next PWM period, which are only turned on while a
+* change is waiting. Doesn't save the colour.
+*
+* Variables:
+* red: duty cycle for the red colour of the LEDs
+* green: duty cycle for the green colour of the LEDs
+* blue: duty cycle for the blue colour of the LEDs
+*/
+void rgb_led_set(uint8_t red, uint8_t green, uint8_t blue);
+
+/** Fades the LEDs to a new colour and saves it to EEPROM.
 *
 * Variables:
 * red: duty cycle for the red colour of the LEDs
@@ -43,9 +63,57 @@ void set_duty_cycles(uint8_t red, uint8_t green, uint8_t blue);
 /** Initialises the button pins as inputs with internal pull-up resistors */
 void button_init_2(void);
 
+/** Samples the button and joystick pins and debounces them. Called from the system tick ISR, so
+* the inputs are sampled at a fixed rate of one sample per tick.
+*/
+void input_scan(void);
+
+/** Sets the debounce windows used by input_scan(). Values outside 1 - INPUT_DEBOUNCE_MAX leave
+* the current window unchanged.
+*
+* Variables:
+* press: number of samples a press must be stable for before it is accepted
+* release: number of samples a release must be stable for before it is accepted
+*/
+void input_set_debounce(uint8_t press, uint8_t release);
+
+/** Sets the debounce windows and saves them to EEPROM. Values outside 1 - INPUT_DEBOUNCE_MAX
+* leave the current window unchanged.
+*
+* Variables:
+* press: number of samples a press must be stable for before it is accepted
+* release: number of samples a release must be stable for before it is accepted
+*/
+void set_debounce(uint8_t press, uint8_t release);
+
+/** Turns eager press mode on or off. In eager press mode the pin change interrupts on ports B, C
+* and D publish a press as soon as the first falling edge is seen, instead of waiting for the
+* debouncer. Releases are still confirmed by the debouncer.
+* The pin change interrupts are turned on either way so that touching the controller wakes the CPU
+* from idle sleep.
+*
+* Variables:
+* enable: true to turn eager press mode on, false to turn it off
+*/
+void input_set_eager(uint8_t enable);
+
+/** Sets the eager press mode and saves it to EEPROM.
+*
+* Variables:
+* eager: the eager press mode, '1' for on and anything else for off
+*/
+void set_eager_press(uint8_t eager);
+
+/** Reads the latest debounced input state without blocking.
+*
+* Returns:
+* state: the input state word, see the INPUT_ macros for the meaning of each bit
+*/
+uint16_t input_state(void);
+
 /** Poll the input pins for the buttons
 *
-* Checks the state of each pin. If a pin is low (button pressed) a 1 is bit shifted into
+* Reads the debounced state of each button. If a button is pressed a 1 is bit shifted into
 * buttonsPressed by the number corresponding to the button pressed. E.g. 0b00000010 means
 * button 2 on the controller has been pressed.
 *
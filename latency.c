@@ -0,0 +1,128 @@
+/*
+**************************************************************************************************************
+* file: latency.c
+* brief: Input to report latency histogram
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "latency.h"
+#include "macros.h"
+#include "telemetry.h"
+#include "timer.h"
+#include <avr/io.h>
+#include <util/atomic.h>
+
+/*
+ * Every change to the debounced inputs is timestamped from Timer1 when it is detected. The stamp
+ * follows the change into the next report queued for the turtle, and the time taken is added to
+ * the histogram once that report's SEND_REPORT transaction has been clocked out of the SPI port.
+ * Only one change and one report are timed at a time, so a burst of changes records the oldest.
+ * Timer1 wraps every 65.536ms, so the system tick count is stamped as well to catch anything longer.
+ */
+
+static volatile uint16_t inputStamp; // Timer1 count when the waiting input change was detected
+static volatile uint16_t inputTick;
+static volatile uint8_t inputPending;
+static volatile uint16_t reportStamp; // Input stamp of the report being sent
+static volatile uint16_t reportTick;
+static volatile uint8_t reportPending;
+static volatile uint16_t histogram[LATENCY_BUCKETS];
+
+/** Timestamps an input change if no earlier change is already waiting to be reported. Called by
+* the input scan and pin change ISRs when the published input state changes.
+*/
+void latency_input(void)
+{
+    if (!inputPending) {
+        inputStamp = TCNT1;
+        inputTick = timer_ticks();
+        inputPending = 1;
+    }
+}
+
+/** Hands the waiting input timestamp to the report that has just been queued for the turtle,
+* unless an earlier report is still being sent. Called after a report is queued.
+*/
+void latency_report_queued(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (inputPending && !reportPending) {
+            reportStamp = inputStamp;
+            reportTick = inputTick;
+            reportPending = 1;
+            inputPending = 0;
+        }
+    }
+}
+
+/** Throws away the waiting input timestamp. Called when the inputs were read but there was nothing
+* new to report, so the change is never timed against an unrelated later report.
+*/
+void latency_discard(void)
+{
+    inputPending = 0;
+}
+
+/** Adds the time since the input change to the histogram. Called from the SPI ISR once the
+* SEND_REPORT transaction has gone out.
+*/
+void latency_report_sent(void)
+{
+    if (!reportPending) {
+        return;
+    }
+    reportPending = 0;
+
+    uint16_t latency = TCNT1 - reportStamp;
+    uint8_t bucket = 0;
+
+    if ((uint16_t)(timer_ticks() - reportTick) >= 0xFFFF / TICK_PERIOD_US) {
+        bucket = LATENCY_BUCKETS - 1; // Timer1 may have wrapped.
+    }
+    while (latency >= 2 && bucket < LATENCY_BUCKETS - 1) {
+        latency >>= 1;
+        bucket++;
+    }
+
+    if (histogram[bucket] != 0xFFFF) {
+        histogram[bucket]++;
+    }
+}
+
+/** Handles a latency query from the GUI. Replies with an 'H' message holding the page number
+* followed by the LATENCY_PAGE_BUCKETS buckets on that page.
+*
+* Variables:
+* page: '0' - '3' for the page to read, or LATENCY_RESET
+*/
+void latency_query(uint8_t page)
+{
+    uint16_t values[1 + LATENCY_PAGE_BUCKETS];
+
+    if (page == LATENCY_RESET) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+                histogram[i] = 0;
+            }
+        }
+        page = '0';
+    }
+
+    page -= '0';
+    if (page >= LATENCY_BUCKETS / LATENCY_PAGE_BUCKETS) {
+        page = 0;
+    }
+
+    values[0] = page;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (uint8_t i = 0; i < LATENCY_PAGE_BUCKETS; i++) {
+            values[1 + i] = histogram[page * LATENCY_PAGE_BUCKETS + i];
+        }
+    }
+
+    telemetry_reply(HISTOGRAM[0], values, 1 + LATENCY_PAGE_BUCKETS);
+}
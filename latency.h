@@ -0,0 +1,48 @@
+/*
+**************************************************************************************************************
+* file: latency.h
+* brief: Input to report latency histogram
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+
+/* Bucket n counts latencies of 2^n to 2^(n+1) - 1 microseconds, except bucket 0 which also counts
+ * 0us and the last bucket which counts everything longer */
+#define LATENCY_BUCKETS 16
+#define LATENCY_PAGE_BUCKETS 4 // Buckets sent in each reply so it fits in one binary frame
+#define LATENCY_RESET 'R' // Clears the histogram then replies with page '0'
+
+/** Timestamps an input change if no earlier change is already waiting to be reported. Called by
+* the input scan and pin change ISRs when the published input state changes.
+*/
+void latency_input(void);
+
+/** Hands the waiting input timestamp to the report that has just been queued for the turtle,
+* unless an earlier report is still being sent. Called after a report is queued.
+*/
+void latency_report_queued(void);
+
+/** Throws away the waiting input timestamp. Called when the inputs were read but there was nothing
+* new to report, so the change is never timed against an unrelated later report.
+*/
+void latency_discard(void);
+
+/** Adds the time since the input change to the histogram. Called from the SPI ISR once the
+* SEND_REPORT transaction has gone out.
+*/
+void latency_report_sent(void);
+
+/** Handles a latency query from the GUI. Replies with an 'H' message holding the page number
+* followed by the LATENCY_PAGE_BUCKETS buckets on that page.
+*
+* Variables:
+* page: '0' - '3' for the page to read, or LATENCY_RESET
+*/
+void latency_query(uint8_t page);
+
+#endif
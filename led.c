@@ -0,0 +1,273 @@
+/*
+**************************************************************************************************************
+* file: led.c
+* brief: LED colour fades and animations
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "led.h"
+#include "hardware.h"
+#include "led_tables.h"
+#include "memory.h"
+#include "timer.h"
+#include <avr/pgmspace.h>
+
+/*
+ * The colour shown is built up in layers every tick: the base colour, fading from the old base
+ * colour to the new one after a change, dimmed by the breathing animation, with the press flash
+ * mixed in on top. Each layer is one keyframe animation from led_tables.h. The result is passed
+ * through the gamma table so equal steps in level look like equal steps in brightness, and the
+ * duty cycles are only reloaded if they have changed. Every step is integer maths with a fixed
+ * amount of work, so a tick always takes about the same short time.
+ *
+ * Streamed colours replace the base colour straight away with no fade and are not saved, so a GUI
+ * can change the colour many times a second without writing to EEPROM. The last one is saved when
+ * the GUI commits it or the stream has been quiet for LED_STREAM_QUIET_MS.
+ */
+
+typedef struct {
+    const Keyframe* frames; // Keyframes in program memory
+    uint8_t count; // Number of keyframes
+    uint8_t index; // Keyframe at or before the current time
+    uint16_t elapsedMs;
+    uint8_t loop; // True if the animation repeats
+    uint8_t running;
+} Animation;
+
+static Animation fade = { fadeFrames, sizeof(fadeFrames) / sizeof(Keyframe), 0, 0, 0, 0 };
+static Animation breathe = { breatheFrames, sizeof(breatheFrames) / sizeof(Keyframe), 0, 0, 1, 0 };
+static Animation flash = { flashFrames, sizeof(flashFrames) / sizeof(Keyframe), 0, 0, 0, 0 };
+
+static uint8_t fromColour[3]; // Base colour being faded from
+static uint8_t toColour[3]; // Base colour being faded to
+static uint8_t baseColour[3]; // Base colour shown on the last tick
+static uint8_t effects = 0; // LED_EFFECT_ flags
+
+/* Latest level of each animation */
+static uint8_t fadeLevel = 255;
+static uint8_t breatheLevel = 255;
+static uint8_t flashLevel = 0;
+
+static uint8_t streamPending = 0; // True if a streamed colour hasn't been saved yet
+static uint16_t lastStream; // Tick count the last colour was streamed at
+
+/** Starts an animation from its first keyframe */
+static void animation_start(Animation* a)
+{
+    a->index = 0;
+    a->elapsedMs = 0;
+    a->running = 1;
+}
+
+/** Works out the level of an animation at its current time, then moves it on by LED_TICK_MS. The
+* level between two keyframes is found by straight line interpolation.
+*
+* Returns:
+* level: the level of the animation, or the level of the last keyframe if it has finished
+*/
+static uint8_t animation_step(Animation* a)
+{
+    uint8_t last = a->count - 1;
+
+    if (!a->running || a->elapsedMs >= pgm_read_word(&a->frames[last].timeMs)) {
+        a->running = a->loop && a->running;
+        a->index = 0;
+        a->elapsedMs = LED_TICK_MS;
+        return pgm_read_byte(&a->frames[last].level);
+    }
+
+    /* Keyframes are further apart than a tick, so this moves on at most one */
+    while (a->elapsedMs >= pgm_read_word(&a->frames[a->index + 1].timeMs)) {
+        a->index++;
+    }
+
+    uint16_t t0 = pgm_read_word(&a->frames[a->index].timeMs);
+    uint16_t t1 = pgm_read_word(&a->frames[a->index + 1].timeMs);
+    int16_t l0 = pgm_read_byte(&a->frames[a->index].level);
+    int16_t l1 = pgm_read_byte(&a->frames[a->index + 1].level);
+    uint8_t level = l0 + (int16_t)((int32_t)(l1 - l0) * (a->elapsedMs - t0) / (t1 - t0));
+
+    a->elapsedMs += LED_TICK_MS;
+    return level;
+}
+
+/** Mixes two levels.
+*
+* Variables:
+* a: the level when amount is 0
+* b: the level when amount is 255
+* amount: how much of b to mix in
+*/
+static uint8_t led_mix(uint8_t a, uint8_t b, uint8_t amount)
+{
+    uint16_t scale = amount + (amount >> 7); // 0 - 256
+
+    return ((uint16_t)a * (256 - scale) + (uint16_t)b * scale) >> 8;
+}
+
+/** Updates the LED duty cycles from the base colour and the latest animation levels */
+static void led_render(void)
+{
+    uint8_t out[3];
+
+    for (uint8_t i = 0; i < 3; i++) {
+        baseColour[i] = led_mix(fromColour[i], toColour[i], fadeLevel);
+        out[i] = led_mix(0, baseColour[i], breatheLevel);
+        out[i] = led_mix(out[i], 255, flashLevel);
+        out[i] = pgm_read_byte(&gammaTable[out[i]]);
+    }
+
+    rgb_led_set(out[0], out[1], out[2]);
+}
+
+/** Replaces the base colour straight away, stopping any fade.
+*
+* Variables:
+* red: red level of the base colour
+* green: green level of the base colour
+* blue: blue level of the base colour
+*/
+static void led_show(uint8_t red, uint8_t green, uint8_t blue)
+{
+    toColour[0] = fromColour[0] = red;
+    toColour[1] = fromColour[1] = green;
+    toColour[2] = fromColour[2] = blue;
+    fade.running = 0;
+    fadeLevel = 255;
+    led_render();
+}
+
+/** Shows a base colour straight away with no fade. Called once at boot.
+*
+* Variables:
+* red: red level of the base colour
+* green: green level of the base colour
+* blue: blue level of the base colour
+*/
+void led_init(uint8_t red, uint8_t green, uint8_t blue)
+{
+    led_show(red, green, blue);
+}
+
+/** Fades from the colour currently shown to a new base colour. Doesn't save the colour.
+*
+* Variables:
+* red: red level of the new base colour
+* green: green level of the new base colour
+* blue: blue level of the new base colour
+*/
+void led_fade_to(uint8_t red, uint8_t green, uint8_t blue)
+{
+    for (uint8_t i = 0; i < 3; i++) {
+        fromColour[i] = baseColour[i];
+    }
+    toColour[0] = red;
+    toColour[1] = green;
+    toColour[2] = blue;
+    animation_start(&fade);
+    streamPending = 0; // The new colour replaces any streamed one.
+}
+
+/** Shows a streamed colour straight away with no fade, without saving it. The last streamed colour
+* is saved by led_stream_commit() or once the stream has been quiet for LED_STREAM_QUIET_MS.
+*
+* Variables:
+* red: red level of the new base colour
+* green: green level of the new base colour
+* blue: blue level of the new base colour
+*/
+void led_stream(uint8_t red, uint8_t green, uint8_t blue)
+{
+    led_show(red, green, blue);
+    streamPending = 1;
+    lastStream = timer_ticks();
+}
+
+/** Saves the last streamed colour, if it hasn't been saved already. */
+void led_stream_commit(void)
+{
+    if (streamPending) {
+        streamPending = 0;
+        save_duty_cycles(toColour[0], toColour[1], toColour[2]);
+    }
+}
+
+/** Copies the last streamed colour into 'colour' if it hasn't been saved yet, so a command that
+* only changes one channel keeps the other two as they are shown. Leaves 'colour' unchanged otherwise.
+*
+* Variables:
+* colour: red, green and blue levels, replaced by the streamed colour
+*/
+void led_stream_colour(uint8_t* colour)
+{
+    if (streamPending) {
+        for (uint8_t i = 0; i < 3; i++) {
+            colour[i] = toColour[i];
+        }
+    }
+}
+
+/** Starts a white flash if press flashes are turned on. Called when a button is pressed. */
+void led_flash(void)
+{
+    if (effects & LED_EFFECT_FLASH) {
+        animation_start(&flash);
+    }
+}
+
+/** Turns effects on or off. Anything other than '0' + a combination of the LED_EFFECT_ flags leaves
+* the effects unchanged.
+*
+* Variables:
+* newEffects: '0' + the LED_EFFECT_ flags to turn on
+*/
+void led_set_effects(uint8_t newEffects)
+{
+    if (newEffects < '0' || newEffects > '0' + LED_EFFECTS_ALL) {
+        return;
+    }
+    newEffects -= '0';
+
+    if ((newEffects & LED_EFFECT_BREATHE) && !(effects & LED_EFFECT_BREATHE)) {
+        animation_start(&breathe);
+    } else if (!(newEffects & LED_EFFECT_BREATHE)) {
+        breathe.running = 0;
+    }
+    if (!(newEffects & LED_EFFECT_FLASH)) {
+        flash.running = 0;
+    }
+    effects = newEffects;
+}
+
+/** Turns effects on or off and saves them to EEPROM.
+*
+* Variables:
+* newEffects: '0' + the LED_EFFECT_ flags to turn on
+*/
+void set_led_effects(uint8_t newEffects)
+{
+    led_set_effects(newEffects);
+    save_led_effects('0' + effects);
+}
+
+/** Advances every running animation by LED_TICK_MS and updates the LED duty cycles. Saves the last
+* streamed colour once the stream has gone quiet. Run by the scheduler every LED_TICK_MS.
+*/
+void led_task(void)
+{
+    fadeLevel = fade.running ? animation_step(&fade) : 255;
+    breatheLevel = breathe.running ? animation_step(&breathe) : 255;
+    flashLevel = flash.running ? animation_step(&flash) : 0;
+
+    led_render();
+    if (!fade.running) {
+        for (uint8_t i = 0; i < 3; i++) {
+            fromColour[i] = toColour[i];
+        }
+    }
+
+    if (streamPending && (uint16_t)(timer_ticks() - lastStream) >= LED_STREAM_QUIET_MS) {
+        led_stream_commit();
+    }
+}
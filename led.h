@@ -0,0 +1,84 @@
+/*
+**************************************************************************************************************
+* file: led.h
+* brief: LED colour fades and animations
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __LED_H__
+#define __LED_H__
+
+#include <stdint.h>
+
+#define LED_TICK_MS 10 // Period of led_task(), animations advance by this much each run
+#define LED_STREAM_QUIET_MS 2000 // A streamed colour is saved once no new one has arrived for this long
+
+/* Effects that can be turned on as well as the base colour, sent by the GUI as '0' + the flags */
+#define LED_EFFECT_BREATHE 0x01 // Slowly dims and brightens the base colour
+#define LED_EFFECT_FLASH 0x02 // Flashes white when a button is pressed
+#define LED_EFFECTS_ALL (LED_EFFECT_BREATHE | LED_EFFECT_FLASH)
+
+/** Shows a base colour straight away with no fade. Called once at boot.
+*
+* Variables:
+* red: red level of the base colour
+* green: green level of the base colour
+* blue: blue level of the base colour
+*/
+void led_init(uint8_t red, uint8_t green, uint8_t blue);
+
+/** Fades from the colour currently shown to a new base colour. Doesn't save the colour.
+*
+* Variables:
+* red: red level of the new base colour
+* green: green level of the new base colour
+* blue: blue level of the new base colour
+*/
+void led_fade_to(uint8_t red, uint8_t green, uint8_t blue);
+
+/** Shows a streamed colour straight away with no fade, without saving it. The last streamed colour
+* is saved by led_stream_commit() or once the stream has been quiet for LED_STREAM_QUIET_MS.
+*
+* Variables:
+* red: red level of the new base colour
+* green: green level of the new base colour
+* blue: blue level of the new base colour
+*/
+void led_stream(uint8_t red, uint8_t green, uint8_t blue);
+
+/** Saves the last streamed colour, if it hasn't been saved already. */
+void led_stream_commit(void);
+
+/** Copies the last streamed colour into 'colour' if it hasn't been saved yet, so a command that
+* only changes one channel keeps the other two as they are shown. Leaves 'colour' unchanged otherwise.
+*
+* Variables:
+* colour: red, green and blue levels, replaced by the streamed colour
+*/
+void led_stream_colour(uint8_t* colour);
+
+/** Starts a white flash if press flashes are turned on. Called when a button is pressed. */
+void led_flash(void);
+
+/** Turns effects on or off. Anything other than '0' + a combination of the LED_EFFECT_ flags leaves
+* the effects unchanged.
+*
+* Variables:
+* newEffects: '0' + the LED_EFFECT_ flags to turn on
+*/
+void led_set_effects(uint8_t newEffects);
+
+/** Turns effects on or off and saves them to EEPROM.
+*
+* Variables:
+* newEffects: '0' + the LED_EFFECT_ flags to turn on
+*/
+void set_led_effects(uint8_t newEffects);
+
+/** Advances every running animation by LED_TICK_MS and updates the LED duty cycles. Saves the last
+* streamed colour once the stream has gone quiet. Run by the scheduler every LED_TICK_MS.
+*/
+void led_task(void);
+
+#endif
@@ -30,6 +30,14 @@
 #define JOYSTICK_X "X"
 #define JOYSTICK_Y "Y"
 #define DPAD_MODE "D"
+#define WEAR "W"
+#define WIRE_MODE "M"
+#define BAUD_RATE "U"
+#define STATS "Q"
+#define HISTOGRAM "H"
+#define PROFILE_TAG "F"
+#define TASKS "T"
+#define POT_STATUS "O"
 
 // -127 in hex 0x81
 // 127 in hex 0x7F
@@ -40,13 +48,27 @@
 
 // Digital Potentiometer Macros
 #define STACK_SELECT 0x00
+// Command byte is AD3 AD2 AD1 AD0 C1 C0 D9 D8
+#define POT_WIPER0_INCREMENT 0x04
+#define POT_WIPER0_DECREMENT 0x08
+#define POT_WIPER0_READ 0x0C
+#define POT_STATUS_READ 0x5C
+#define POT_CMDERR 0x02 // Bit of the first byte read back, cleared if the command was invalid
+#define POT_READ_ERROR 0xFFFF
 
 // EEPROM Address Macros (10 bit address)
+// Addresses 0 - 4 are only read on the first boot, after that those settings live in the
+// wear leveled log (eeprom_log.h)
 #define LED_R_ADDR 0x0000
 #define LED_G_ADDR 0X0001
 #define LED_B_ADDR 0x0002
 #define POT_ADDR 0x0003
 #define DPAD_ADDR 0x0004
+#define DEBOUNCE_PRESS_ADDR 0x0005
+#define DEBOUNCE_RELEASE_ADDR 0x0006
+#define EAGER_ADDR 0x0007
+#define REPORT_INTERVAL_ADDR 0x0008
+#define LED_EFFECTS_ADDR 0x0009
 
 // Other EEPROM Macros
 #define EEPROM_SIZE 1023
@@ -57,6 +79,12 @@ enum {
     EEPROM_INVALID_ADDR
 };
 
+enum {
+    SPI_OK,
+    SPI_QUEUE_FULL,
+    SPI_INVALID_LENGTH
+};
+
 #define B0 0
 #define B1 1
 #define B2 2
@@ -8,184 +8,167 @@
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "command.h"
 #include "communication.h"
 #include "eeprom.h"
 #include "hardware.h"
+#include "led.h"
 #include "macros.h"
 #include "memory.h"
 #include "pot.h"
+#include "report.h"
+#include "scheduler.h"
 #include "spi.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "timer.h"
 #include "uart.h"
 
 #include <util/delay.h>
 
-/** Parses the message received from the GUI and calls the functions need to 
-* properly act on the message contents.
-*
-* Variables:
-* addr <char*>: the UART macro defining what the data byte is for
-* data <data*>
-*/
-void parse_message(char addr, char data)
+/* Controller state carried between runs of the input task */
+static char data = 0x00;
+static char oldData = 0x00;
+static int dpad_byte = 0;
+static uint8_t emMode = 0;
+
+/** Sends the D-pad emulation mode to the GUI and parses whatever the GUI has sent so far. */
+static void task_commands(void)
 {
-    data = (int)data;
-    if (addr == 'R') {
-        EEPROM_update(LED_R_ADDR, data);
-    } else if (addr == 'G') {
-        EEPROM_update(LED_G_ADDR, data);
-    } else if (addr == 'B') {
-        EEPROM_update(LED_B_ADDR, data);
-    } else if (addr == 'V') {
-        set_volume(data);
-    } else if (addr == 'D') {
-        EEPROM_update(DPAD_ADDR, data);
-    } else {
-        ; //Do nothing, invalid message;
-    }
+    /* Sending emMode to GUI */
+    emMode = settings.emMode;
+    telemetry_set(TELEMETRY_DPAD_MODE, emMode == '1');
+
+    /* GUI Message Check and Parsing */
+    command_task(); // Parsing whatever the GUI has sent so far.
 }
 
-/** Reads in the chars sent to the Atmega by the GUI over UART and parses
-* them using the parse_message() function.
+/** Reads the buttons and joystick and sends the whole controller state to the turtle with a single
+* report when it changes.
 */
-void read_uart()
+static void task_inputs(void)
 {
-    char addr, data;
-    /* Read in 2 bytes */
-    addr = fgetc(stdin);
-    data = fgetc(stdin);
-    parse_message(addr, data);
+    int joystickDirectionX = 0;
+    int joystickDirectionY = 0;
+    int X = 0;
+    int Y = 0;
+    ReportFrame frame;
+
+    /* Button polling and updating */
+    data = poll_button_press();
+    if (data != oldData) {
+        if (data & ~oldData) {
+            led_flash(); // A button has just been pressed.
+        }
+        oldData = 0x00;
+        oldData = data;
+        telemetry_set(TELEMETRY_BUTTONS, data);
+    }
+
+    /* Joystick Polling */
+    joystickDirectionX = poll_joystick_x();
+    joystickDirectionY = poll_joystick_y();
+
+    switch (joystickDirectionX) {
+    case 7: // POSITIVE X
+        X = POS;
+        dpad_byte |= (1 << RIGHT);
+        telemetry_set(TELEMETRY_X, 2);
+        break;
+    case 10: // NEGATIVE X
+        X = NEG;
+        dpad_byte |= (1 << LEFT);
+        telemetry_set(TELEMETRY_X, 1);
+        break;
+    default:
+        X = ZERO;
+        dpad_byte &= ~((1 << RIGHT) | (1 << LEFT));
+        telemetry_set(TELEMETRY_X, 0);
+        break;
+    }
+
+    switch (joystickDirectionY) {
+    case 8: // POSITVE Y
+        Y = NEG;
+        dpad_byte |= (1 << UP);
+        telemetry_set(TELEMETRY_Y, 2);
+        break;
+    case 9: // NEGATIVE Y
+        Y = POS;
+        dpad_byte |= (1 << DOWN);
+        telemetry_set(TELEMETRY_Y, 1);
+        break;
+    default:
+        Y = ZERO;
+        dpad_byte &= ~((1 << UP) | (1 << DOWN));
+        telemetry_set(TELEMETRY_Y, 0);
+        break;
+    }
+
+    /* Sending the whole controller state to the turtle with a single report when it changes */
+    frame.buttons = data;
+    if (emMode == '1') {
+        frame.dpad = dpad_byte;
+        frame.x = ZERO;
+        frame.y = ZERO;
+    } else {
+        frame.dpad = ZERO;
+        frame.x = X;
+        frame.y = Y;
+    }
+    report_update(&frame);
+    report_task();
 }
 
+/* The input scan runs in the Timer1 tick ISR itself so its sample period never jitters. Every
+ * other job is a task here, in priority order. Periods and deadlines are in milliseconds. */
+static const Task tasks[] PROGMEM = {
+    { task_inputs, 1, 1 }, // Polling the inputs and reporting to the turtle
+    { task_commands, 1, 5 },
+    { uart_baud_task, 1, 1 }, // Timing a baud rate switch
+    { pot_task, POT_RAMP_MS, POT_RAMP_MS }, // Ramping the volume
+    { led_task, LED_TICK_MS, LED_TICK_MS }, // Stepping the LED fades and animations
+    { persist_settings, 10, 50 }, // Writing changed settings to EEPROM in the background
+    { telemetry_task, TELEMETRY_REFRESH_MS, TELEMETRY_REFRESH_MS }, // Resending every telemetry channel to the GUI
+};
+
+#define TASK_COUNT (sizeof(tasks) / sizeof(tasks[0]))
+
 int main(void)
 {
     /* Initialisations */
+    load_settings(); // Read the settings from EEPROM before anything uses them.
     sei(); // Enable global interrupts.
     joystick_init_2(); // Initialise Joystick.
     rgb_led_init(); // Initialise LED GPIO pins.
     rgb_led_PWM_init(); // Initialising LED PWM.
+    led_init(settings.ledRed, settings.ledGreen, settings.ledBlue); // Showing the saved colour.
     init_serial_stdio(9600, 0); // Initialise UART.
     spi_master_init(); // Initialise SPI.
     button_init_2(); // Initialise buttons.
+    timer1_init(); // Initialise Timer1 time base and start scanning the inputs.
+    turtle_link_calibrate(); // Finding how fast the turtle can take transactions.
 
-    char data = 0x00;
-    char oldData = 0x00;
-    int joystickDirectionX = 0;
-    int joystickDirectionY = 0;
-    int dpad_byte = 0;
-    int X = 0;
-    int Y = 0;
-
-    uint8_t emMode = 0;
-    uint8_t volume = 0;
+    /* Set the potentiometer to the saved volume */
+    pot_init(settings.volume);
 
-    /* Read in volume from memory and set the potentiometer to it */
-    EEPROM_read(POT_ADDR, &volume);
-    set_volume(volume);
+    /* Apply the input and report settings, unprogrammed EEPROM leaves the defaults in place */
+    input_set_debounce(settings.debouncePress, settings.debounceRelease);
+    input_set_eager(settings.eager == '1');
+    report_set_interval(settings.reportInterval);
+    led_set_effects(settings.ledEffects);
 
+    scheduler_init(tasks, TASK_COUNT);
     while (1) {
-        /* Sending emMode to GUI */
-
-        EEPROM_read(DPAD_ADDR, &emMode);
-        if (emMode == '1') {
-            printf("%s%d\n", DPAD_MODE, 1);
-        } else {
-            printf("%s%d\n", DPAD_MODE, 0);
-        }
-
-        /* GUI Message Check and Parsing */
-        if (serial_input_available()) { // Checking for and reading UART messages from GUI.
-            read_uart();
-        }
-
-        /* Button polling and updating */
-        data = poll_button_press();
-        if (data != oldData) {
-            oldData = 0x00;
-            oldData = data;
-            update(BUTTON, BR0, data);
-        }
+        scheduler_run();
 
-        /* Joystick Polling */
-        joystickDirectionX = poll_joystick_x();
-        joystickDirectionY = poll_joystick_y();
-
-        switch (joystickDirectionX) {
-        case 7: // POSITIVE X
-            X = POS;
-            dpad_byte |= (1 << RIGHT);
-            printf("%s%d\n", JOYSTICK_X, 2);
-            break;
-        case 10: // NEGATIVE X
-            X = NEG;
-            dpad_byte |= (1 << LEFT);
-            printf("%s%d\n", JOYSTICK_X, 1);
-            break;
-        default:
-            X = ZERO;
-            dpad_byte &= ~((1 << RIGHT) | (1 << LEFT));
-            printf("%s%d\n", JOYSTICK_X, 0);
-            break;
-        }
-
-        switch (joystickDirectionY) {
-        case 8: // POSITVE Y
-            Y = NEG;
-            dpad_byte |= (1 << UP);
-            printf("%s%d\n", JOYSTICK_Y, 2);
-            break;
-        case 9: // NEGATIVE Y
-            Y = POS;
-            dpad_byte |= (1 << DOWN);
-            printf("%s%d\n", JOYSTICK_Y, 1);
-            break;
-        default:
-            Y = ZERO;
-            dpad_byte &= ~((1 << UP) | (1 << DOWN));
-            printf("%s%d\n", JOYSTICK_Y, 0);
-            break;
-        }
-
-        if (emMode == '1') {
-            spi_update(DPAD, dpad_byte);
-            spi_update(JSX, ZERO);
-            spi_update(JSY, ZERO);
-        } else {
-            spi_update(DPAD, ZERO);
-            spi_update(JSX, X);
-            spi_update(JSY, Y);
-        }
+        /* Measuring how fast the loop is running */
+        stats_loop();
     }
     return 0;
 }
-
-/*ISR for timer 0 interrupts (8 bits)*/
-ISR(TIMER0_OVF_vect)
-{
-    //Update output compare registers
-    uint8_t red, green;
-
-    EEPROM_read(LED_R_ADDR, &red);
-    dutyCycleRed = 255 - red;
-    OCR0A = dutyCycleRed;
-
-    EEPROM_read(LED_G_ADDR, &green);
-    dutyCycleGreen = 255 - green;
-    OCR0B = dutyCycleGreen;
-}
-
-/*ISR for timer 2 interrupts (8 bits)*/
-ISR(TIMER2_OVF_vect)
-{
-    //Update output compare registers
-    uint8_t blue;
-
-    EEPROM_read(LED_B_ADDR, &blue);
-    dutyCycleBlue = 255 - blue;
-
-    //Update output compare registers
-    OCR2B = dutyCycleBlue;
-}
\ No newline at end of file
@@ -8,10 +8,93 @@
 
 #include "memory.h"
 #include "eeprom.h"
+#include "eeprom_log.h"
 #include "macros.h"
 #include <avr/io.h>
 
-/** Saves the LED duty cycle variables to EEPROM using EEPROM_update() .
+/*
+ * Every setting is read from EEPROM once at boot into the settings cache. Saving a setting updates
+ * the cache first, so readers see the new value straight away, and then writes it to EEPROM.
+ * The LED colour, volume and DPAD emulation mode change often, so they are written as records in
+ * the wear leveled log by persist_settings() rather than to their fixed addresses.
+ */
+Settings settings;
+static uint8_t logDirty = 0; // True if the logged settings have changed since the last record
+
+/** Reads every setting from EEPROM into the settings cache using EEPROM_read(). Must be called
+* once at boot before any setting is used.
+*/
+void load_settings(void)
+{
+    EEPROM_read(LED_R_ADDR, &settings.ledRed);
+    EEPROM_read(LED_G_ADDR, &settings.ledGreen);
+    EEPROM_read(LED_B_ADDR, &settings.ledBlue);
+    EEPROM_read(POT_ADDR, &settings.volume);
+    EEPROM_read(DPAD_ADDR, &settings.emMode);
+    EEPROM_read(DEBOUNCE_PRESS_ADDR, &settings.debouncePress);
+    EEPROM_read(DEBOUNCE_RELEASE_ADDR, &settings.debounceRelease);
+    EEPROM_read(EAGER_ADDR, &settings.eager);
+    EEPROM_read(REPORT_INTERVAL_ADDR, &settings.reportInterval);
+    EEPROM_read(LED_EFFECTS_ADDR, &settings.ledEffects);
+
+    LogRecord record;
+    if (log_recover(&record)) {
+        settings.ledRed = record.ledRed;
+        settings.ledGreen = record.ledGreen;
+        settings.ledBlue = record.ledBlue;
+        settings.volume = record.volume;
+        settings.emMode = record.emMode;
+    } else {
+        logDirty = 1; // First boot with the log, move the fixed address values into it.
+    }
+}
+
+/** Writes a new log record if the LED colour, volume or DPAD emulation mode have changed since
+* the last one and the EEPROM queue has room for it. Changes made while a record is still being
+* written are merged into the next record, and a record that failed to verify is written again.
+* Run by the scheduler every 10ms, with a 50ms deadline.
+*/
+void persist_settings(void)
+{
+    /* A record that didn't verify is written again to the next slot */
+    if (EEPROM_status() == EEPROM_WRITE_FAIL) {
+        logDirty = 1;
+    }
+
+    if (!logDirty || EEPROM_queue_space() < LOG_RECORD_SIZE) {
+        return;
+    }
+
+    LogRecord record;
+    record.ledRed = settings.ledRed;
+    record.ledGreen = settings.ledGreen;
+    record.ledBlue = settings.ledBlue;
+    record.volume = settings.volume;
+    record.emMode = settings.emMode;
+    log_write(&record);
+    logDirty = 0;
+}
+
+/** Writes any changed settings to EEPROM straight away and waits until every queued write has
+* finished and been verified. Must be called with interrupts enabled.
+*
+* Returns:
+* EEPROM_WRITE_FAIL: returned if a write failed to verify, the failed record is written again later
+* EEPROM_OK: returned if every setting is saved
+*/
+uint8_t flush_settings(void)
+{
+    EEPROM_flush(); // Make room for a whole record.
+    persist_settings();
+    if (EEPROM_flush() == EEPROM_WRITE_FAIL) {
+        persist_settings(); // Queues the record again, the caller isn't held up any longer.
+        return EEPROM_WRITE_FAIL;
+    }
+    return EEPROM_OK;
+}
+
+/** Saves the LED duty cycle variables to the settings cache and marks them to be written to the
+* settings log by persist_settings().
 *
 * Variables:
 * red: duty cycle for the red colour of the LEDs
@@ -20,34 +103,93 @@
 */
 void save_duty_cycles(uint8_t red, uint8_t green, uint8_t blue)
 {
-    EEPROM_update(LED_R_ADDR, red);
-    EEPROM_update(LED_G_ADDR, green);
-    EEPROM_update(LED_B_ADDR, blue);
+    if (settings.ledRed != red || settings.ledGreen != green || settings.ledBlue != blue) {
+        settings.ledRed = red;
+        settings.ledGreen = green;
+        settings.ledBlue = blue;
+        logDirty = 1;
+    }
 }
 
-/** Saves the wiper value of the digital potentiometer to EEPROM using
-* EEPROM_update().
+/** Saves the wiper value of the digital potentiometer to the settings cache and marks it to be
+* written to the settings log by persist_settings().
 *
 * Variables:
 * wiperVal: the wiper value for the digital potentiometer.
 */
 void save_wiper_val(uint8_t wiperVal)
 {
-    EEPROM_update(POT_ADDR, wiperVal);
+    if (settings.volume != wiperVal) {
+        settings.volume = wiperVal;
+        logDirty = 1;
+    }
 }
 
-/** Saves the DPAD emulation mode variable to EEPROM using EEPROM_update().
+/** Saves the DPAD emulation mode variable to the settings cache and marks it to be written to the
+* settings log by persist_settings().
 *
 * Variables:
 * emMode: the emulation mode
 */
 void save_em_mode(uint8_t em_mode)
 {
-    EEPROM_update(DPAD_ADDR, em_mode);
+    if (settings.emMode != em_mode) {
+        settings.emMode = em_mode;
+        logDirty = 1;
+    }
+}
+
+/** Saves the debounce windows to the settings cache and then to EEPROM using EEPROM_update().
+*
+* Variables:
+* press: number of samples a press must be stable for
+* release: number of samples a release must be stable for
+*/
+void save_debounce(uint8_t press, uint8_t release)
+{
+    settings.debouncePress = press;
+    settings.debounceRelease = release;
+
+    EEPROM_update(DEBOUNCE_PRESS_ADDR, press);
+    EEPROM_update(DEBOUNCE_RELEASE_ADDR, release);
 }
 
-/** Reads the LED duty cycle variables from EEPROM and saves them to the
-* corresponding duty cycle variables using EEPROM_read().
+/** Saves the eager press mode variable to the settings cache and then to EEPROM using
+* EEPROM_update().
+*
+* Variables:
+* eager: the eager press mode ('1' or '0')
+*/
+void save_eager_mode(uint8_t eager)
+{
+    settings.eager = eager;
+    EEPROM_update(EAGER_ADDR, eager);
+}
+
+/** Saves the report interval to the settings cache and then to EEPROM using EEPROM_update().
+*
+* Variables:
+* interval: the minimum time between reports to the turtle in milliseconds
+*/
+void save_report_interval(uint8_t interval)
+{
+    settings.reportInterval = interval;
+    EEPROM_update(REPORT_INTERVAL_ADDR, interval);
+}
+
+/** Saves the LED effects to the settings cache and then to EEPROM using EEPROM_update().
+*
+* Variables:
+* effects: '0' + the LED_EFFECT_ flags that are turned on
+*/
+void save_led_effects(uint8_t effects)
+{
+    settings.ledEffects = effects;
+    EEPROM_update(LED_EFFECTS_ADDR, effects);
+}
+
+/** Reads the LED duty cycle variables from the settings cache and saves them to the
+* corresponding duty cycle variables.
 *
 * Variables:
 * dutyCycleRed: pointer to the variable to store the duty cycle of the
@@ -59,13 +201,12 @@ void save_em_mode(uint8_t em_mode)
 */
 void get_duty_cycles(uint8_t* dutyCycleRed, uint8_t* dutyCycleGreen, uint8_t* dutyCycleBlue)
 {
-    EEPROM_read(LED_R_ADDR, dutyCycleRed);
-    EEPROM_read(LED_G_ADDR, dutyCycleGreen);
-    EEPROM_read(LED_B_ADDR, dutyCycleRed);
+    *dutyCycleRed = settings.ledRed;
+    *dutyCycleGreen = settings.ledGreen;
+    *dutyCycleBlue = settings.ledBlue;
 }
 
-/** Reads the wiper value from EEPROM and saves it to wiperVal
-* using EEPROM_read().
+/** Reads the wiper value from the settings cache and saves it to wiperVal.
 *
 * Variables:
 * wiperVal: the pointer to the variable to store the wiper value of the
@@ -73,16 +214,47 @@ void get_duty_cycles(uint8_t* dutyCycleRed, uint8_t* dutyCycleGreen, uint8_t* du
 */
 void get_wiper_val(uint8_t* wiperVal)
 {
-    EEPROM_read(POT_ADDR, wiperVal);
+    *wiperVal = settings.volume;
 }
 
-/** Reads the emulation mode variable from EEPROM and saves it to emMode
-* using EEPROM_read().
+/** Reads the emulation mode variable from the settings cache and saves it to emMode.
 *
 * Variables:
 * emMode: pointer to the variable to store the emulation mode variable
 */
 void get_em_mode(uint8_t* em_mode)
 {
-    EEPROM_read(DPAD_ADDR, em_mode);
+    *em_mode = settings.emMode;
+}
+
+/** Reads the debounce windows from the settings cache.
+*
+* Variables:
+* press: pointer to the variable to store the press window
+* release: pointer to the variable to store the release window
+*/
+void get_debounce(uint8_t* press, uint8_t* release)
+{
+    *press = settings.debouncePress;
+    *release = settings.debounceRelease;
+}
+
+/** Reads the eager press mode variable from the settings cache.
+*
+* Variables:
+* eager: pointer to the variable to store the eager press mode
+*/
+void get_eager_mode(uint8_t* eager)
+{
+    *eager = settings.eager;
+}
+
+/** Reads the report interval from the settings cache.
+*
+* Variables:
+* interval: pointer to the variable to store the report interval
+*/
+void get_report_interval(uint8_t* interval)
+{
+    *interval = settings.reportInterval;
 }
\ No newline at end of file
@@ -11,7 +11,49 @@
 
 #include <stdint.h>
 
-/** Saves the LED duty cycle variables to EEPROM using EEPROM_update() .
+/** RAM copy of every setting stored in EEPROM. Loaded once at boot by load_settings() and kept up to
+* date by the save functions, so reading a setting is a single load and never waits on the EEPROM.
+* Only the main loop writes to it.
+*/
+typedef struct {
+    uint8_t ledRed;
+    uint8_t ledGreen;
+    uint8_t ledBlue;
+    uint8_t volume;
+    uint8_t emMode;
+    uint8_t debouncePress;
+    uint8_t debounceRelease;
+    uint8_t eager;
+    uint8_t reportInterval;
+    uint8_t ledEffects;
+} Settings;
+
+extern Settings settings;
+
+/** Reads every setting from EEPROM into the settings cache using EEPROM_read(). The LED colour,
+* volume and DPAD emulation mode come from the newest record in the wear leveled log. Must be called
+* once at boot before any setting is used.
+*/
+void load_settings(void);
+
+/** Writes a new log record if the LED colour, volume or DPAD emulation mode have changed since
+* the last one and the EEPROM queue has room for it. Changes made while a record is still being
+* written are merged into the next record, and a record that failed to verify is written again.
+* Run by the scheduler every 10ms, with a 50ms deadline.
+*/
+void persist_settings(void);
+
+/** Writes any changed settings to EEPROM straight away and waits until every queued write has
+* finished and been verified. Must be called with interrupts enabled.
+*
+* Returns:
+* EEPROM_WRITE_FAIL: returned if a write failed to verify, the failed record is written again later
+* EEPROM_OK: returned if every setting is saved
+*/
+uint8_t flush_settings(void);
+
+/** Saves the LED duty cycle variables to the settings cache and marks them to be written to the
+* settings log by persist_settings().
 *
 * Variables:
 * red: duty cycle for the red colour of the LEDs
@@ -20,23 +62,54 @@
 */
 void save_duty_cycles(uint8_t red, uint8_t green, uint8_t blue);
 
-/** Saves the wiper value of the digital potentiometer to EEPROM using 
-* EEPROM_update().
+/** Saves the wiper value of the digital potentiometer to the settings cache and marks it to be
+* written to the settings log by persist_settings().
 *
 * Variables:
 * wiperVal: the wiper value for the digital potentiometer.
 */
 void save_wiper_val(uint8_t wiperVal);
 
-/** Saves the DPAD emulation mode variable to EEPROM using EEPROM_update().
+/** Saves the DPAD emulation mode variable to the settings cache and marks it to be written to the
+* settings log by persist_settings().
 *
 * Variables:
 * emMode: the emulation mode 
 */
 void save_em_mode(uint8_t emMode);
 
-/** Reads the LED duty cycle variables from EEPROM and saves them to the 
-* corresponding duty cycle variables using EEPROM_read().
+/** Saves the debounce windows to the settings cache and then to EEPROM using EEPROM_update().
+*
+* Variables:
+* press: number of samples a press must be stable for
+* release: number of samples a release must be stable for
+*/
+void save_debounce(uint8_t press, uint8_t release);
+
+/** Saves the eager press mode variable to the settings cache and then to EEPROM using
+* EEPROM_update().
+*
+* Variables:
+* eager: the eager press mode ('1' or '0')
+*/
+void save_eager_mode(uint8_t eager);
+
+/** Saves the report interval to the settings cache and then to EEPROM using EEPROM_update().
+*
+* Variables:
+* interval: the minimum time between reports to the turtle in milliseconds
+*/
+void save_report_interval(uint8_t interval);
+
+/** Saves the LED effects to the settings cache and then to EEPROM using EEPROM_update().
+*
+* Variables:
+* effects: '0' + the LED_EFFECT_ flags that are turned on
+*/
+void save_led_effects(uint8_t effects);
+
+/** Reads the LED duty cycle variables from the settings cache and saves them to the 
+* corresponding duty cycle variables.
 *
 * Variables:
 * dutyCycleRed: pointer to the variable to store the duty cycle of the 
@@ -48,8 +121,7 @@ void save_em_mode(uint8_t emMode);
 */
 void get_duty_cycles(uint8_t* dutyCycleRed, uint8_t* dutyCycleGreen, uint8_t* dutyCycleBlue);
 
-/** Reads the wiper value from EEPROM and saves it to wiperVal 
-* using EEPROM_read().
+/** Reads the wiper value from the settings cache and saves it to wiperVal.
 *
 * Variables:
 * wiperVal: the pointer to the variable to store the wiper value of the 
@@ -57,12 +129,33 @@ void get_duty_cycles(uint8_t* dutyCycleRed, uint8_t* dutyCycleGreen, uint8_t* du
 */
 void get_wiper_val(uint8_t* wiperVal);
 
-/** Reads the emulation mode variable from EEPROM and saves it to emMode
-* using EEPROM_read().
+/** Reads the emulation mode variable from the settings cache and saves it to emMode.
 *
 * Variables:
 * emMode: pointer to the variable to store the emulation mode variable
 */
 void get_em_mode(uint8_t* emMode);
 
+/** Reads the debounce windows from the settings cache.
+*
+* Variables:
+* press: pointer to the variable to store the press window
+* release: pointer to the variable to store the release window
+*/
+void get_debounce(uint8_t* press, uint8_t* release);
+
+/** Reads the eager press mode variable from the settings cache.
+*
+* Variables:
+* eager: pointer to the variable to store the eager press mode
+*/
+void get_eager_mode(uint8_t* eager);
+
+/** Reads the report interval from the settings cache.
+*
+* Variables:
+* interval: pointer to the variable to store the report interval
+*/
+void get_report_interval(uint8_t* interval);
+
 #endif
@@ -6,34 +6,184 @@
 **************************************************************************************************************
 */
 
+#include "pot.h"
 #include "communication.h"
 #include "macros.h"
 #include "memory.h"
+#include "spi.h"
+#include "telemetry.h"
+#include "timer.h"
 
-/** Sets the the wiper value in the digital potentiometer to wiperVal and 
-* saves that new value to EEPROM using save_wiper_val().
+/*
+ * Volume changes only set a target. pot_task() moves the wiper towards the target using the
+ * potentiometer's increment and decrement commands, up to POT_RAMP_STEP positions per single byte
+ * command transaction, so a slider drag from the GUI turns into a smooth ramp with no zipper noise.
+ * The volume is saved once it has stopped changing for POT_SETTLE_MS, and the wiper is read back
+ * then so any step the potentiometer missed is corrected. Reads made after boot are queued like any
+ * other transaction and their results picked up on a later pass, so no task waits on the SPI bus.
+ */
+
+/* States of a background read */
+#define POT_READ_IDLE 0 // Nothing to read
+#define POT_READ_WAITING 1 // Waiting for room in the SPI queue
+#define POT_READ_QUEUED 2 // Queued, waiting for the result
+
+static uint16_t currentWiper = 0; // Wiper position the potentiometer is set to
+static uint16_t targetWiper = 0; // Wiper position being ramped towards
+static uint8_t targetVolume = 0;
+static uint8_t savePending = 0; // True if the target hasn't been saved yet
+static uint16_t lastChange; // Tick count the target last changed at
+static uint8_t wiperCheck = POT_READ_IDLE; // Reading the wiper back after the volume has settled
+static uint8_t query = POT_READ_IDLE; // Reading the registers for the GUI
+
+/** Works out the wiper position for a volume. Volume 0 uses the full scale position, which
+* completely mutes the speaker.
+*
+* Variables:
+* volume: the volume (0 - 127)
+*
+* Returns:
+* wiper: the 9 bit wiper position
+*/
+static uint16_t pot_wiper(uint8_t volume)
+{
+    if (volume == 0) {
+        return POT_WIPER_MUTE;
+    }
+    return 255 - 2 * volume;
+}
+
+/** Sets the wiper straight to the saved volume with no ramp. The wiper is read back first and
+* only written if it doesn't already hold the saved volume. Called once at boot.
+*
+* Variables:
+* volume: the saved volume (0 - 127)
+*/
+void pot_init(uint8_t volume)
+{
+    if (volume > POT_VOLUME_MAX) {
+        volume = POT_VOLUME_MAX;
+    }
+
+    targetVolume = volume;
+    targetWiper = pot_wiper(volume);
+    currentWiper = targetWiper;
+    savePending = 0;
+
+    if (pot_read(POT_WIPER0_READ) != targetWiper) {
+        pot_update(targetWiper >> 8, targetWiper & 0xFF);
+    }
+    telemetry_set(TELEMETRY_VOLUME, volume);
+}
+
+/** Sets the volume the wiper of the digital potentiometer ramps towards. The new volume is saved
+* using save_wiper_val() once it stops changing. Returns straight away.
 *
 * Variables:
 * volume: the wiper value for the digital potentiometer.
 */
 void set_volume(uint8_t volume)
 {
-    if (volume > 127) {
-        volume = 127;
+    if (volume > POT_VOLUME_MAX) {
+        volume = POT_VOLUME_MAX;
     }
 
-    uint8_t byte_1 = 0x00;
-    uint8_t wiperVal = 0;
-    wiperVal = 255 - 2 * volume;
+    targetVolume = volume;
+    targetWiper = pot_wiper(volume);
+    savePending = 1;
+    lastChange = timer_ticks();
+    telemetry_set(TELEMETRY_VOLUME, volume);
+}
 
-    if (volume != 0) {
-        ; // Do nothing.
+/** Turns the volume up or down by one step from the current target.
+*
+* Variables:
+* up: true to turn the volume up, false to turn it down
+*/
+void pot_nudge(uint8_t up)
+{
+    if (up && targetVolume < POT_VOLUME_MAX) {
+        set_volume(targetVolume + 1);
+    } else if (!up && targetVolume > 0) {
+        set_volume(targetVolume - 1);
+    }
+}
 
-    } else {
-        byte_1 = 0x01; // Set the 9th bit high to completely mute the speaker.
+/** Starts reading the wiper position and status register back from the potentiometer. pot_task()
+* replies to the GUI with them once both have arrived, using POT_READ_ERROR for a register that
+* couldn't be read.
+*/
+void pot_query(void)
+{
+    if (query == POT_READ_IDLE) {
+        query = POT_READ_WAITING;
     }
+}
 
-    //pot_update(wiperVal, 0x00); Use this for actual code
-    pot_update(byte_1, wiperVal);
-    save_wiper_val(volume);
+/** Moves a GUI query along, queuing its reads once there is room for both and replying once both
+* have arrived.
+*/
+static void pot_query_task(void)
+{
+    uint16_t values[2];
+
+    if (query == POT_READ_WAITING && spi_queue_space() >= 2) {
+        pot_read_queue(POT_WIPER0_READ);
+        pot_read_queue(POT_STATUS_READ);
+        query = POT_READ_QUEUED;
+    } else if (query == POT_READ_QUEUED && pot_read_result(POT_WIPER0_READ, &values[0])
+        && pot_read_result(POT_STATUS_READ, &values[1])) {
+        telemetry_reply(POT_STATUS[0], values, 2);
+        query = POT_READ_IDLE;
+    }
+}
+
+/** Moves the wiper up to POT_RAMP_STEP positions towards the target, then saves the target once
+* it has stopped changing for POT_SETTLE_MS and reads the wiper back. Also moves GUI queries along.
+* Run by the scheduler every POT_RAMP_MS.
+*/
+void pot_task(void)
+{
+    pot_query_task();
+
+    /* No steps are queued while the wiper is being read back, so the result is where it really is */
+    if (wiperCheck == POT_READ_QUEUED) {
+        uint16_t wiper;
+
+        if (!pot_read_result(POT_WIPER0_READ, &wiper)) {
+            return;
+        }
+        if (wiper != POT_READ_ERROR) {
+            currentWiper = wiper;
+        }
+        wiperCheck = POT_READ_IDLE;
+    }
+
+    if (currentWiper != targetWiper) {
+        uint8_t command = POT_WIPER0_INCREMENT;
+        uint16_t distance = targetWiper - currentWiper;
+
+        if (currentWiper > targetWiper) {
+            command = POT_WIPER0_DECREMENT;
+            distance = currentWiper - targetWiper;
+        }
+        uint8_t steps = (distance > POT_RAMP_STEP) ? POT_RAMP_STEP : distance;
+
+        /* If the SPI queue is busy the step is tried again next time */
+        if (pot_step(command, steps) == SPI_OK) {
+            currentWiper = (command == POT_WIPER0_INCREMENT) ? currentWiper + steps : currentWiper - steps;
+        }
+        return;
+    }
+
+    if (savePending && (uint16_t)(timer_ticks() - lastChange) >= POT_SETTLE_MS) {
+        save_wiper_val(targetVolume);
+        savePending = 0;
+        wiperCheck = POT_READ_WAITING; // Steps are not acknowledged, so check where the wiper ended up.
+    }
+
+    /* If the SPI queue is busy the read is tried again next time */
+    if (wiperCheck == POT_READ_WAITING && pot_read_queue(POT_WIPER0_READ) == SPI_OK) {
+        wiperCheck = POT_READ_QUEUED;
+    }
 }
@@ -9,12 +9,47 @@
 #ifndef __POT_H__
 #define __POT_H__
 
-/** Sets the the wiper value in the digital potentiometer to wiperVal and
-* saves that new value to EEPROM using save_wiper_val().
+#include <stdint.h>
+
+#define POT_VOLUME_MAX 127
+#define POT_WIPER_MUTE 0x100 // Full scale wiper position, used for volume 0
+#define POT_RAMP_MS 2 // Period of pot_task(), a full sweep takes POT_WIPER_MUTE * POT_RAMP_MS / POT_RAMP_STEP
+#define POT_RAMP_STEP 2 // Wiper positions moved per step, one volume step
+#define POT_SETTLE_MS 500 // The volume is saved once it hasn't changed for this long
+
+/** Sets the wiper straight to the saved volume with no ramp. The wiper is read back first and
+* only written if it doesn't already hold the saved volume. Called once at boot.
+*
+* Variables:
+* volume: the saved volume (0 - 127)
+*/
+void pot_init(uint8_t volume);
+
+/** Sets the volume the wiper of the digital potentiometer ramps towards. The new volume is saved
+* using save_wiper_val() once it stops changing. Returns straight away.
 *
 * Variables:
 * volume: the wiper value for the digital potentiometer.
 */
 void set_volume(uint8_t volume);
 
-#endif
\ No newline at end of file
+/** Turns the volume up or down by one step from the current target.
+*
+* Variables:
+* up: true to turn the volume up, false to turn it down
+*/
+void pot_nudge(uint8_t up);
+
+/** Starts reading the wiper position and status register back from the potentiometer. pot_task()
+* replies to the GUI with them once both have arrived, using POT_READ_ERROR for a register that
+* couldn't be read.
+*/
+void pot_query(void);
+
+/** Moves the wiper up to POT_RAMP_STEP positions towards the target, then saves the target once
+* it has stopped changing for POT_SETTLE_MS and reads the wiper back. Also moves GUI queries along.
+* Run by the scheduler every POT_RAMP_MS.
+*/
+void pot_task(void);
+
+#endif
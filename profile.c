@@ -0,0 +1,123 @@
+/*
+**************************************************************************************************************
+* file: profile.c
+* brief: Optional main loop stage profiler
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include "macros.h"
+#include "telemetry.h"
+#include "timer.h"
+
+/*
+ * Stages are timed with the free running Timer1, which counts microseconds (8 CPU cycles). The
+ * time taken to read the timer, a couple of microseconds, is included in each stage. Averages are
+ * kept as a running total and count; when the count fills up both are halved so the average keeps
+ * following the recent behaviour.
+ */
+
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;
+    uint16_t count;
+} ProfileStage;
+
+static ProfileStage stages[PROFILE_STAGES];
+static uint16_t loopStart; // Timer1 count at the start of the current iteration
+static uint16_t lastMark; // Timer1 count at the start of the current stage
+static uint8_t loopStarted; // False until the first iteration has started
+
+/** Adds one measurement to a stage.
+*
+* Variables:
+* stage: the stage the measurement is for
+* time: the time the stage took in microseconds
+*/
+static void profile_record(uint8_t stage, uint16_t time)
+{
+    ProfileStage* s = &stages[stage];
+
+    if (s->count == 0 || time < s->min) {
+        s->min = time;
+    }
+    if (time > s->max) {
+        s->max = time;
+    }
+    if (s->count == 0xFFFF) {
+        s->total >>= 1;
+        s->count >>= 1;
+    }
+    s->total += time;
+    s->count++;
+}
+
+/** Marks the start of a main loop iteration and times the whole of the previous one. */
+void profile_loop_start(void)
+{
+    uint16_t now = timer_now();
+
+    if (loopStarted) {
+        profile_record(PROFILE_LOOP, now - loopStart);
+    }
+    loopStarted = 1;
+    loopStart = now;
+}
+
+/** Marks the start of a stage. */
+void profile_begin(void)
+{
+    lastMark = timer_now();
+}
+
+/** Times a stage from the last call to profile_begin() up to now.
+*
+* Variables:
+* stage: the stage that has just finished (a task number)
+*/
+void profile_mark(uint8_t stage)
+{
+    profile_record(stage, timer_now() - lastMark);
+}
+
+/** Handles a profiler query from the GUI. Replies with an 'F' message holding the stage number
+* followed by the minimum, average and maximum time the stage took in microseconds.
+*
+* Variables:
+* stage: '0' - '8' for the stage to read, or PROFILE_RESET
+*/
+void profile_query(uint8_t stage)
+{
+    uint16_t values[4];
+
+    if (stage == PROFILE_RESET) {
+        for (uint8_t i = 0; i < PROFILE_STAGES; i++) {
+            stages[i].min = 0;
+            stages[i].max = 0;
+            stages[i].total = 0;
+            stages[i].count = 0;
+        }
+        loopStarted = 0; // The reply would otherwise be counted in the loop period.
+        stage = '0';
+    }
+
+    stage -= '0';
+    if (stage >= PROFILE_STAGES) {
+        stage = 0;
+    }
+
+    ProfileStage* s = &stages[stage];
+    values[0] = stage;
+    values[1] = s->min;
+    values[2] = s->count ? s->total / s->count : 0;
+    values[3] = s->max;
+
+    telemetry_reply(PROFILE_TAG[0], values, 4);
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+**************************************************************************************************************
+* file: profile.h
+* brief: Optional main loop stage profiler
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+#include "scheduler.h"
+
+/*
+ * Build with -DPROFILE to time each stage of the main loop. Without it the PROFILE_ macros expand
+ * to nothing and the 'F' command is left out, so the profiler costs no time or memory.
+ */
+
+/* Stages 0 - SCHEDULER_MAX_TASKS - 1 are the scheduler tasks, numbered by their place in the task
+ * table in main.c */
+#define PROFILE_LOOP SCHEDULER_MAX_TASKS // One pass of the scheduler, from the start of one to the next
+#define PROFILE_STAGES (SCHEDULER_MAX_TASKS + 1)
+
+#define PROFILE_RESET 'R' // Clears every stage then replies with stage '0'
+
+#ifdef PROFILE
+
+/** Marks the start of a main loop iteration and times the whole of the previous one. */
+void profile_loop_start(void);
+
+/** Marks the start of a stage. */
+void profile_begin(void);
+
+/** Times a stage from the last call to profile_begin() up to now.
+*
+* Variables:
+* stage: the stage that has just finished (a task number)
+*/
+void profile_mark(uint8_t stage);
+
+/** Handles a profiler query from the GUI. Replies with an 'F' message holding the stage number
+* followed by the minimum, average and maximum time the stage took in microseconds.
+*
+* Variables:
+* stage: '0' - '8' for the stage to read, or PROFILE_RESET
+*/
+void profile_query(uint8_t stage);
+
+#define PROFILE_LOOP_START() profile_loop_start()
+#define PROFILE_BEGIN() profile_begin()
+#define PROFILE_MARK(stage) profile_mark(stage)
+
+#else
+
+#define PROFILE_LOOP_START()
+#define PROFILE_BEGIN()
+#define PROFILE_MARK(stage)
+
+#endif
+
+#endif
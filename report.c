@@ -0,0 +1,93 @@
+/*
+**************************************************************************************************************
+* file: report.c
+* brief: Change driven reporting to the turtle
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "report.h"
+#include "communication.h"
+#include "latency.h"
+#include "macros.h"
+#include "memory.h"
+#include "timer.h"
+#include <string.h>
+
+/*
+ * The last snapshot that was committed to the turtle is kept so that a frame is only sent when
+ * something actually changed. The pending snapshot always holds the latest state, so changes that
+ * happen between two reports are merged into one.
+ */
+static ReportFrame pending;
+static ReportFrame committed;
+static uint8_t committedValid = 0; // False until the first frame has been sent
+static uint8_t reportInterval = REPORT_INTERVAL_DEFAULT;
+static uint16_t lastReport = 0; // Tick count when the last frame was sent
+
+/** Sets the minimum time between reports to the turtle. Only 1, 2, 4 and 8ms are accepted to match
+* the USB poll intervals, any other value leaves the current interval unchanged.
+*
+* Variables:
+* interval: the minimum time between reports in milliseconds
+*/
+void report_set_interval(uint8_t interval)
+{
+    if (interval == 1 || interval == 2 || interval == 4 || interval == 8) {
+        reportInterval = interval;
+    }
+}
+
+/** Sets the report interval and saves it to EEPROM. Only 1, 2, 4 and 8ms are accepted.
+*
+* Variables:
+* interval: the minimum time between reports in milliseconds
+*/
+void set_report_interval(uint8_t interval)
+{
+    report_set_interval(interval);
+    save_report_interval(reportInterval);
+}
+
+/** Replaces the pending controller snapshot with the latest one. Snapshots that arrive faster than
+* the report interval overwrite each other, so only the latest value is ever sent.
+*
+* Variables:
+* frame: the latest controller snapshot
+*/
+void report_update(ReportFrame* frame)
+{
+    pending = *frame;
+}
+
+/** Sends the pending snapshot to the turtle if it differs from the last one sent and the report
+* interval has passed since then. Otherwise it only polls the turtle for the acknowledgement of the
+* last report, so it can be called every loop.
+*/
+void report_task(void)
+{
+    /* Send the latest state again if the turtle missed a report */
+    if (turtle_link_lost()) {
+        committedValid = 0;
+    }
+
+    if (committedValid && memcmp(&pending, &committed, sizeof(ReportFrame)) == 0) {
+        latency_discard();
+        /* No new report will carry the acknowledgement of the last one, so ask for it */
+        turtle_link_probe(committed.buttons);
+        return; // Nothing has changed.
+    }
+
+    uint16_t now = timer_ticks();
+    if (committedValid && (uint16_t)(now - lastReport) < reportInterval) {
+        return; // Too soon, the change is merged into the next report.
+    }
+
+    /* If the SPI queue is still busy the frame is tried again next time with the latest state */
+    if (spi_update_frame(&pending) == SPI_OK) {
+        committed = pending;
+        committedValid = 1;
+        lastReport = now;
+        latency_report_queued();
+    }
+}
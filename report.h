@@ -0,0 +1,46 @@
+/*
+**************************************************************************************************************
+* file: report.h
+* brief: Change driven reporting to the turtle
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __REPORT_H__
+#define __REPORT_H__
+
+#include "communication.h"
+#include <stdint.h>
+
+#define REPORT_INTERVAL_DEFAULT 1 // Milliseconds between reports, matches a 1ms USB poll interval
+
+/** Sets the minimum time between reports to the turtle. Only 1, 2, 4 and 8ms are accepted to match
+* the USB poll intervals, any other value leaves the current interval unchanged.
+*
+* Variables:
+* interval: the minimum time between reports in milliseconds
+*/
+void report_set_interval(uint8_t interval);
+
+/** Sets the report interval and saves it to EEPROM. Only 1, 2, 4 and 8ms are accepted.
+*
+* Variables:
+* interval: the minimum time between reports in milliseconds
+*/
+void set_report_interval(uint8_t interval);
+
+/** Replaces the pending controller snapshot with the latest one. Snapshots that arrive faster than
+* the report interval overwrite each other, so only the latest value is ever sent.
+*
+* Variables:
+* frame: the latest controller snapshot
+*/
+void report_update(ReportFrame* frame);
+
+/** Sends the pending snapshot to the turtle if it differs from the last one sent and the report
+* interval has passed since then. Otherwise it only polls the turtle for the acknowledgement of the
+* last report, so it can be called every loop.
+*/
+void report_task(void);
+
+#endif
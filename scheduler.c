@@ -0,0 +1,203 @@
+/*
+**************************************************************************************************************
+* file: scheduler.c
+* brief: Cooperative run to completion task scheduler
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "scheduler.h"
+#include "macros.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "timer.h"
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+
+/*
+ * Tasks are released on the 1ms system tick from Timer1, so their cadence does not depend on how
+ * much else the controller is doing. A released task is run to completion the next time the
+ * scheduler gets to it. If it starts more than its deadline after its release it is counted as an
+ * overrun, and any releases it missed in the meantime are dropped rather than run back to back.
+ * Time spent with nothing to run is measured as idle time. While idle the CPU is put into idle
+ * sleep, which stops the core but leaves the peripherals running, so it wakes within a few cycles
+ * on the next tick, a received byte, a pin change on the inputs or any other interrupt.
+ */
+
+typedef struct {
+    uint16_t release; // Tick count the task is next released at
+    uint16_t runs;
+    uint16_t overruns;
+    uint16_t maxLateMs; // Latest the task has started after its release
+} TaskState;
+
+static const Task* tasks;
+static uint8_t taskCount;
+static TaskState state[SCHEDULER_MAX_TASKS];
+
+static uint8_t idle; // True while nothing is due
+static uint16_t idleStart; // Timer1 count the current idle period started at
+static uint32_t idleUs; // Idle time in the current window
+static uint16_t windowStart; // Tick count the current window started at
+static uint16_t idlePermille; // Idle time in the last window in tenths of a percent
+static uint32_t sleepUs; // Time asleep in the current window
+static uint16_t sleepPermille; // Time asleep in the last window in tenths of a percent
+
+/** Starts scheduling a table of tasks. Every task is released straight away and then once every
+* period. Tasks earlier in the table are run first when several are due at once.
+*
+* Variables:
+* table: the tasks, stored in program memory
+* count: the number of tasks in table (at most SCHEDULER_MAX_TASKS)
+*/
+void scheduler_init(const Task* table, uint8_t count)
+{
+    uint16_t now = timer_ticks();
+
+    tasks = table;
+    taskCount = (count > SCHEDULER_MAX_TASKS) ? SCHEDULER_MAX_TASKS : count;
+    for (uint8_t i = 0; i < taskCount; i++) {
+        state[i].release = now;
+    }
+    windowStart = now;
+    idle = 0;
+    idleUs = 0;
+    sleepUs = 0;
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+/** Updates the idle time measurement.
+*
+* Variables:
+* busy: true if a task is about to run, false if nothing is due
+*/
+static void scheduler_idle(uint8_t busy)
+{
+    if (busy && idle) {
+        idleUs += (uint16_t)(timer_now() - idleStart);
+        idle = 0;
+    } else if (!busy && !idle) {
+        idleStart = timer_now();
+        idle = 1;
+    }
+}
+
+/** Puts the CPU to sleep until the next interrupt, unless a task has been released since the
+* scheduler last checked.
+*/
+static void scheduler_sleep(void)
+{
+    cli();
+    uint16_t now = timer_ticks();
+    for (uint8_t i = 0; i < taskCount; i++) {
+        if ((int16_t)(now - state[i].release) >= 0) {
+            sei();
+            return;
+        }
+    }
+
+    uint16_t start = TCNT1;
+    sleep_enable();
+    sei(); // The instruction after sei always runs before any interrupt, so a wake up can't be missed.
+    sleep_cpu();
+    sleep_disable();
+    sleepUs += (uint16_t)(timer_now() - start);
+}
+
+/** Runs every task that is due, each one to completion. Called forever from main. */
+void scheduler_run(void)
+{
+    uint8_t ran = 0;
+
+    PROFILE_LOOP_START();
+    for (uint8_t i = 0; i < taskCount; i++) {
+        TaskState* s = &state[i];
+        uint16_t now = timer_ticks();
+        uint16_t late = now - s->release;
+
+        if ((int16_t)late < 0) {
+            continue; // Not released yet.
+        }
+        if (!ran) {
+            scheduler_idle(1);
+            ran = 1;
+        }
+
+        if (late > pgm_read_word(&tasks[i].deadlineMs) && s->overruns != 0xFFFF) {
+            s->overruns++;
+        }
+        if (late > s->maxLateMs) {
+            s->maxLateMs = late;
+        }
+        if (s->runs != 0xFFFF) {
+            s->runs++;
+        }
+
+        PROFILE_BEGIN();
+        ((TaskFunction)pgm_read_word(&tasks[i].function))();
+        PROFILE_MARK(i);
+
+        /* Keep the cadence fixed, unless releases were missed */
+        uint16_t period = pgm_read_word(&tasks[i].periodMs);
+        s->release += period;
+        if ((int16_t)(now - s->release) >= 0) {
+            s->release = now + period;
+        }
+    }
+
+    if (!ran) {
+        scheduler_idle(0);
+        scheduler_sleep();
+    }
+
+    uint16_t now = timer_ticks();
+    if ((uint16_t)(now - windowStart) >= SCHEDULER_IDLE_WINDOW_MS) {
+        if (idle) { // Split the idle period in progress between the two windows.
+            scheduler_idle(1);
+            scheduler_idle(0);
+        }
+        idlePermille = idleUs / SCHEDULER_IDLE_WINDOW_MS;
+        sleepPermille = sleepUs / SCHEDULER_IDLE_WINDOW_MS;
+        idleUs = 0;
+        sleepUs = 0;
+        windowStart = now;
+    }
+}
+
+/** Handles a scheduler query from the GUI. Replies with a 'T' message holding the task number, the
+* number of times it has run, its deadline overruns, the latest it has started in milliseconds, the
+* idle time and the time spent asleep, both in tenths of a percent. The rest of the time is awake.
+*
+* Variables:
+* task: '0' - '7' for the task to read, or SCHEDULER_RESET
+*/
+void scheduler_query(uint8_t task)
+{
+    uint16_t values[6];
+
+    if (task == SCHEDULER_RESET) {
+        for (uint8_t i = 0; i < taskCount; i++) {
+            state[i].runs = 0;
+            state[i].overruns = 0;
+            state[i].maxLateMs = 0;
+        }
+        task = '0';
+    }
+
+    task -= '0';
+    if (task >= taskCount) {
+        task = 0;
+    }
+
+    values[0] = task;
+    values[1] = state[task].runs;
+    values[2] = state[task].overruns;
+    values[3] = state[task].maxLateMs;
+    values[4] = idlePermille;
+    values[5] = sleepPermille;
+
+    telemetry_reply(TASKS[0], values, 6);
+}
@@ -0,0 +1,47 @@
+/*
+**************************************************************************************************************
+* file: scheduler.h
+* brief: Cooperative run to completion task scheduler
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+
+#define SCHEDULER_MAX_TASKS 8
+#define SCHEDULER_IDLE_WINDOW_MS 1000 // Period the idle time is measured over
+#define SCHEDULER_RESET 'R' // Clears every task's counters then replies with task '0'
+
+typedef void (*TaskFunction)(void);
+
+typedef struct {
+    TaskFunction function;
+    uint16_t periodMs; // Time between releases of the task
+    uint16_t deadlineMs; // How late after its release the task may start before it counts as overrun
+} Task;
+
+/** Starts scheduling a table of tasks. Every task is released straight away and then once every
+* period. Tasks earlier in the table are run first when several are due at once.
+*
+* Variables:
+* table: the tasks, stored in program memory
+* count: the number of tasks in table (at most SCHEDULER_MAX_TASKS)
+*/
+void scheduler_init(const Task* table, uint8_t count);
+
+/** Runs every task that is due, each one to completion. Called forever from main. */
+void scheduler_run(void);
+
+/** Handles a scheduler query from the GUI. Replies with a 'T' message holding the task number, the
+* number of times it has run, its deadline overruns, the latest it has started in milliseconds, the
+* idle time and the time spent asleep, both in tenths of a percent. The rest of the time is awake.
+*
+* Variables:
+* task: '0' - '7' for the task to read, or SCHEDULER_RESET
+*/
+void scheduler_query(uint8_t task);
+
+#endif
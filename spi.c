@@ -6,8 +6,42 @@
 **************************************************************************************************************
 */
 #include "spi.h"
+#include "communication.h"
+#include "latency.h"
+#include "macros.h"
+#include "stats.h"
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/atomic.h>
+
+/*
+ * Transactions are queued by the main loop and sent in the background. The SPI transfer complete
+ * interrupt loads each following byte and moves on to the next transaction once the current one
+ * has been sent. If the next transaction needs the slave select lines to be idle for longer than
+ * they have been, the Timer1 compare A interrupt is used to start it once the guard time is over.
+ * The queue has a single producer (the main loop) and a single consumer (the ISRs).
+ */
+
+#define SPI_QUEUE_MASK (SPI_QUEUE_SIZE - 1)
+
+/* SPI engine states */
+#define SPI_IDLE 0
+#define SPI_GUARD 1
+#define SPI_ACTIVE 2
+
+typedef struct {
+    uint8_t slave;
+    uint8_t length;
+    uint16_t guardUs;
+    uint8_t data[SPI_TRANSACTION_MAX];
+} SpiTransaction;
+
+static volatile SpiTransaction queue[SPI_QUEUE_SIZE];
+static volatile uint8_t queueHead; // Position the next transaction is added at
+static volatile uint8_t queueTail; // Position of the transaction being sent
+static volatile uint8_t txIndex; // Byte of the current transaction being sent
+static volatile uint8_t engineState;
+static volatile uint16_t lastDeselect; // Timer1 count when a slave was last deselected
 
 /** Initialises everything needed for SPI communication */
 void spi_master_init(void)
@@ -25,17 +59,133 @@ void spi_master_init(void)
 
     /* Enable SPI, Master, set clock rate fck/16, set clock mode */
     SPCR = (1 << SPE) | (1 << MSTR) | (1 << SPR0) | (0 << CPOL) | (0 << CPHA);
+
+    /* Initialising the transaction queue */
+    queueHead = 0;
+    queueTail = 0;
+    engineState = SPI_IDLE;
+    lastDeselect = TCNT1;
 }
 
 /** Transmits the given byte to the slave using SPI */
 uint8_t spi_master_transmit(char data)
 {
+    spi_flush();
+
     SPDR = data;
     while (!(SPSR & (1 << SPIF)))
         ;
     return SPDR;
 }
 
+/** Selects the slave of the transaction at the tail of the queue and sends its first byte.
+* Must be called with interrupts disabled.
+*/
+static void spi_begin_transaction(void)
+{
+    volatile SpiTransaction* t = &queue[queueTail];
+
+    if (t->slave == SPI_SLAVE_POT) {
+        select_pot();
+    } else {
+        select_turtle();
+    }
+
+    txIndex = 0;
+    engineState = SPI_ACTIVE;
+    SPCR |= (1 << SPIE);
+    SPDR = t->data[0];
+}
+
+/** Starts the next queued transaction, or waits for its guard time using Timer1 compare A if the
+* slave select lines have not been idle for long enough. Must be called with interrupts disabled.
+*/
+static void spi_start_next(void)
+{
+    if (queueTail == queueHead) {
+        engineState = SPI_IDLE;
+        return;
+    }
+
+    uint16_t guard = queue[queueTail].guardUs;
+    if ((uint16_t)(TCNT1 - lastDeselect) < guard) {
+        OCR1A = lastDeselect + guard;
+        TIFR1 = (1 << OCF1A);
+        TIMSK1 |= (1 << OCIE1A);
+        engineState = SPI_GUARD;
+
+        /* The compare match may already have gone past while OCR1A was being set */
+        if ((uint16_t)(TCNT1 - lastDeselect) < guard) {
+            return;
+        }
+        TIMSK1 &= ~(1 << OCIE1A);
+        TIFR1 = (1 << OCF1A);
+    }
+    spi_begin_transaction();
+}
+
+/** Adds a transaction to the SPI transmit queue. The transaction is sent in the background by the
+* SPI transfer complete interrupt, so this returns straight away.
+*
+* Variables:
+* slave: the slave to send to (SPI_SLAVE_TURTLE or SPI_SLAVE_POT)
+* data: the bytes to be sent while the slave is selected
+* length: the number of bytes in data (1 - SPI_TRANSACTION_MAX)
+* guardUs: the minimum time in microseconds the slave select lines must have been idle before this
+*	transaction starts.
+*
+* Returns:
+* SPI_QUEUE_FULL: returned if there is no room for the transaction
+* SPI_OK: returned if the transaction was queued
+*/
+uint8_t spi_enqueue(uint8_t slave, uint8_t* data, uint8_t length, uint16_t guardUs)
+{
+    if (spi_queue_space() == 0) {
+        return SPI_QUEUE_FULL;
+    }
+
+    volatile SpiTransaction* t = &queue[queueHead];
+    t->slave = slave;
+    t->length = length;
+    t->guardUs = guardUs;
+    for (uint8_t i = 0; i < length; i++) {
+        t->data[i] = data[i];
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        queueHead = (queueHead + 1) & SPI_QUEUE_MASK;
+        if (engineState == SPI_IDLE) {
+            spi_start_next();
+        }
+    }
+    return SPI_OK;
+}
+
+/** Returns the number of transactions that can currently be added to the queue */
+uint8_t spi_queue_space(void)
+{
+    /* One slot is kept free to tell a full queue from an empty one */
+    return SPI_QUEUE_MASK - ((queueHead - queueTail) & SPI_QUEUE_MASK);
+}
+
+/** Checks if a transaction is queued or in progress
+*
+* Returns:
+* boolean: false if the SPI engine is idle, true otherwise
+*/
+uint8_t spi_busy(void)
+{
+    return engineState != SPI_IDLE;
+}
+
+/** Blocks until every queued transaction has been sent. Must be called with interrupts enabled. */
+void spi_flush(void)
+{
+    while (spi_busy())
+        ;
+}
+
 /** Selects the turtle as the SPI slave by setting SS pin on Atmega low.
 * SS pin is active low 
 */
@@ -66,4 +216,55 @@ void select_pot(void)
 void deselect_pot(void)
 {
     PORTD |= (1 << PORTD2);
-}
\ No newline at end of file
+}
+
+/** SPI Transfer Complete ISR.
+*
+* Passes the turtle's status byte and the bytes read back from the potentiometer on, then sends the
+* next byte of the current transaction, or deselects the slave and moves on to the next transaction
+* once the last byte has gone.
+*/
+ISR(SPI_STC_vect)
+{
+    volatile SpiTransaction* t = &queue[queueTail];
+
+    /* The turtle sends its status byte while the first byte goes out */
+    if (txIndex == 0 && t->slave == SPI_SLAVE_TURTLE) {
+        turtle_link_status(SPDR, t->data[0], t->data[1]);
+    }
+    /* The potentiometer sends back register values while a read command goes out */
+    if (t->slave == SPI_SLAVE_POT) {
+        pot_read_byte(t->data[0], txIndex, SPDR);
+    }
+
+    txIndex++;
+    if (txIndex < t->length) {
+        SPDR = t->data[txIndex];
+        return;
+    }
+
+    if (t->slave == SPI_SLAVE_POT) {
+        deselect_pot();
+    } else {
+        deselect_turtle();
+    }
+    lastDeselect = TCNT1;
+    SPCR &= ~(1 << SPIE);
+    STATS_COUNT(spiFrames[t->slave]);
+    if (t->slave == SPI_SLAVE_TURTLE && t->data[0] == SEND_REPORT) {
+        latency_report_sent();
+    }
+
+    queueTail = (queueTail + 1) & SPI_QUEUE_MASK;
+    spi_start_next();
+}
+
+/** Timer1 Compare A ISR.
+*
+* The guard time before the transaction at the tail of the queue has passed, so start it.
+*/
+ISR(TIMER1_COMPA_vect)
+{
+    TIMSK1 &= ~(1 << OCIE1A);
+    spi_begin_transaction();
+}
@@ -11,14 +11,53 @@
 
 #include <stdint.h>
 
+/* SPI slaves, used to tag queued transactions */
+#define SPI_SLAVE_TURTLE 0 // SS on PB2
+#define SPI_SLAVE_POT 1 // SS on PD2
+#define SPI_SLAVES 2
+
+#define SPI_QUEUE_SIZE 8 // Must be a power of 2
+#define SPI_TRANSACTION_MAX 4 // Maximum number of bytes sent in one chip select window
+
 /** 
 * Initialises SPI for Atmega328P. SPI pins are on DDRB
 */
 void spi_master_init(void);
 
-/** Transmits the given byte to the slave using SPI */
+/** Transmits the given byte to the slave using SPI. Waits for the transaction queue to empty first
+* so blocking transfers never interleave with queued ones.
+*/
 uint8_t spi_master_transmit(char data);
 
+/** Adds a transaction to the SPI transmit queue. The transaction is sent in the background by the
+* SPI transfer complete interrupt, so this returns straight away.
+*
+* Variables:
+* slave: the slave to send to (SPI_SLAVE_TURTLE or SPI_SLAVE_POT)
+* data: the bytes to be sent while the slave is selected
+* length: the number of bytes in data (1 - SPI_TRANSACTION_MAX)
+* guardUs: the minimum time in microseconds the slave select lines must have been idle before this
+*	transaction starts. Timed by Timer1 so the CPU is not held up.
+*
+* Returns:
+* SPI_QUEUE_FULL: returned if there is no room for the transaction
+* SPI_OK: returned if the transaction was queued
+*/
+uint8_t spi_enqueue(uint8_t slave, uint8_t* data, uint8_t length, uint16_t guardUs);
+
+/** Returns the number of transactions that can currently be added to the queue */
+uint8_t spi_queue_space(void);
+
+/** Checks if a transaction is queued or in progress
+*
+* Returns:
+* boolean: false if the SPI engine is idle, true otherwise
+*/
+uint8_t spi_busy(void);
+
+/** Blocks until every queued transaction has been sent. Must be called with interrupts enabled. */
+void spi_flush(void);
+
 /** Selects the turtle as the SPI slave by setting SS pin on Atmega low.
 * SS pin is active low
 */
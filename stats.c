@@ -0,0 +1,88 @@
+/*
+**************************************************************************************************************
+* file: stats.c
+* brief: Link and firmware statistics counters
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "stats.h"
+#include "communication.h"
+#include "macros.h"
+#include "telemetry.h"
+#include "timer.h"
+#include <util/atomic.h>
+
+/*
+ * The counters are updated where the events happen, several of them from ISRs, and only ever read
+ * or cleared by the main loop with interrupts disabled so a 16 bit counter is never seen half
+ * updated.
+ */
+
+volatile Stats stats;
+
+static uint16_t loops; // Main loop iterations in the current window
+static uint16_t windowStart; // Tick count the current window started at
+
+/** Counts a main loop iteration and updates the loop rate once every STATS_LOOP_WINDOW_MS. Called
+* once every loop.
+*/
+void stats_loop(void)
+{
+    uint16_t now = timer_ticks();
+
+    if (loops != 0xFFFF) {
+        loops++;
+    }
+    if ((uint16_t)(now - windowStart) >= STATS_LOOP_WINDOW_MS) {
+        stats.loopsPerSecond = loops;
+        loops = 0;
+        windowStart = now;
+    }
+}
+
+/** Handles a stats query from the GUI. Replies with a 'Q' message holding the page number
+* followed by the counters on that page.
+*
+* Variables:
+* page: STATS_PAGE_LINK, STATS_PAGE_DEVICES, STATS_PAGE_TURTLE or STATS_RESET
+*/
+void stats_query(uint8_t page)
+{
+    uint16_t values[5];
+
+    if (page == STATS_RESET) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            uint8_t* counter = (uint8_t*)&stats;
+            for (uint8_t i = 0; i < sizeof(stats); i++) {
+                counter[i] = 0;
+            }
+        }
+        page = STATS_PAGE_LINK;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (page == STATS_PAGE_TURTLE) {
+            values[1] = stats.turtleNotReady;
+            values[2] = stats.turtleReportsLost;
+            values[3] = turtle_register_guard();
+            values[4] = turtle_report_guard();
+        } else if (page == STATS_PAGE_DEVICES) {
+            values[1] = stats.spiFrames[0];
+            values[2] = stats.spiFrames[1];
+            values[3] = stats.eepromWrites;
+            values[4] = stats.eepromVerifyFails;
+        } else {
+            page = STATS_PAGE_LINK;
+            values[1] = stats.rxOverruns;
+            values[2] = stats.txStalls;
+            values[3] = stats.txDrops;
+            values[4] = stats.loopsPerSecond;
+        }
+    }
+    values[0] = page - '0';
+
+    telemetry_reply(STATS[0], values, 5);
+}
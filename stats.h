@@ -0,0 +1,58 @@
+/*
+**************************************************************************************************************
+* file: stats.h
+* brief: Link and firmware statistics counters
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "spi.h"
+#include <stdint.h>
+
+/* Pages of the stats reply, each one fits in a single binary frame */
+#define STATS_PAGE_LINK '0' // RX overruns, TX stalls, TX drops, main loop iterations per second
+#define STATS_PAGE_DEVICES '1' // Turtle and potentiometer SPI transactions, EEPROM writes and failures
+#define STATS_PAGE_TURTLE '2' // Turtle not ready, reports lost, register and report guard times in us
+#define STATS_RESET 'R' // Clears every counter then replies with the link page
+
+#define STATS_LOOP_WINDOW_MS 1000 // Period the main loop iterations are counted over
+
+/* Counters stick at their maximum value rather than wrapping back to a small number */
+typedef struct {
+    uint16_t rxOverruns; // Bytes lost because the UART input buffer was full
+    uint16_t txStalls; // Times the main loop had to wait for room in the UART output buffer
+    uint16_t txDrops; // Writes thrown away because the UART output buffer was full with interrupts off
+    uint16_t spiFrames[SPI_SLAVES]; // Transactions sent to each SPI slave (SPI_SLAVE_TURTLE, SPI_SLAVE_POT)
+    uint16_t eepromWrites; // Bytes actually programmed into EEPROM
+    uint16_t eepromVerifyFails; // Writes that did not read back correctly
+    uint16_t loopsPerSecond; // Main loop iterations in the last STATS_LOOP_WINDOW_MS
+    uint16_t turtleNotReady; // Transactions the turtle said it wasn't ready for
+    uint16_t turtleReportsLost; // Reports the turtle didn't acknowledge
+} Stats;
+
+extern volatile Stats stats;
+
+/* Counts one event. Safe to use from ISRs and from the main loop for counters only it updates. */
+#define STATS_COUNT(counter)         \
+    do {                             \
+        if (stats.counter != 0xFFFF) \
+            stats.counter++;         \
+    } while (0)
+
+/** Counts a main loop iteration and updates the loop rate once every STATS_LOOP_WINDOW_MS. Called
+* once every loop.
+*/
+void stats_loop(void);
+
+/** Handles a stats query from the GUI. Replies with a 'Q' message holding the page number
+* followed by the counters on that page.
+*
+* Variables:
+* page: STATS_PAGE_LINK, STATS_PAGE_DEVICES, STATS_PAGE_TURTLE or STATS_RESET
+*/
+void stats_query(uint8_t page);
+
+#endif
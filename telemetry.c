@@ -0,0 +1,219 @@
+/*
+**************************************************************************************************************
+* file: telemetry.c
+* brief: Latest value telemetry to the GUI
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "telemetry.h"
+#include "frame.h"
+#include "macros.h"
+#include "memory.h"
+#include "uart.h"
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <util/atomic.h>
+
+/*
+ * Each channel has one slot that only ever holds its latest value, and a dirty bit that is set when
+ * the value changes. The UART transmit interrupt turns dirty slots into text lines, or in binary
+ * mode a single frame holding every dirty slot, and sends them whenever the link is free. If the
+ * link is slower than the values change, intermediate values are simply overwritten, so the GUI
+ * link can never hold up the rest of the controller.
+ */
+
+/* How a channel's value is written in text mode */
+#define FORMAT_RAW 0
+#define FORMAT_DECIMAL 1
+
+typedef struct {
+    char tag; // Text line prefix and binary field type
+    uint8_t format;
+} TelemetryChannel;
+
+static const TelemetryChannel channels[TELEMETRY_CHANNELS] PROGMEM = {
+    { 'B', FORMAT_RAW }, // TELEMETRY_BUTTONS
+    { 'X', FORMAT_DECIMAL }, // TELEMETRY_X
+    { 'Y', FORMAT_DECIMAL }, // TELEMETRY_Y
+    { 'D', FORMAT_DECIMAL }, // TELEMETRY_DPAD_MODE
+    { 'V', FORMAT_DECIMAL }, // TELEMETRY_VOLUME
+};
+
+static volatile uint8_t values[TELEMETRY_CHANNELS];
+static volatile uint8_t dirty; // Bit n set if channel n is waiting to be sent
+static volatile uint8_t wireMode = WIRE_MODE_TEXT;
+
+/* Line or frame being sent by the ISR */
+static uint8_t txBuffer[FRAME_MAX];
+static uint8_t txLength = 0;
+static uint8_t txPos = 0;
+static uint8_t nextChannel = 0; // Channels are sent round robin in text mode
+
+/** Stores the latest value of a channel. If the value has changed the channel is marked to be sent
+* by the UART transmit interrupt once the link is free. Never blocks.
+*
+* Variables:
+* channel: the channel to update (TELEMETRY_BUTTONS, TELEMETRY_X, etc.)
+* value: the latest value of the channel
+*/
+void telemetry_set(uint8_t channel, uint8_t value)
+{
+    if (values[channel] == value) {
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        values[channel] = value;
+        dirty |= (1 << channel);
+    }
+    uart_start_tx();
+}
+
+/** Marks every channel to be sent so a GUI that connects late still sees the current state. Run by
+* the scheduler every TELEMETRY_REFRESH_MS.
+*/
+void telemetry_task(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        dirty = (1 << TELEMETRY_CHANNELS) - 1;
+    }
+    uart_start_tx();
+}
+
+/** Formats the latest value of a channel into the transmit buffer as a text line.
+*
+* Variables:
+* channel: the channel to format
+*/
+static void telemetry_format_text(uint8_t channel)
+{
+    uint8_t value = values[channel];
+
+    txLength = 0;
+    txBuffer[txLength++] = pgm_read_byte(&channels[channel].tag);
+
+    if (pgm_read_byte(&channels[channel].format) == FORMAT_RAW) {
+        txBuffer[txLength++] = value; // Raw byte, as the GUI protocol has always sent it.
+    } else {
+        if (value >= 100) {
+            txBuffer[txLength++] = '0' + value / 100;
+        }
+        if (value >= 10) {
+            txBuffer[txLength++] = '0' + (value / 10) % 10;
+        }
+        txBuffer[txLength++] = '0' + value % 10;
+    }
+
+    txBuffer[txLength++] = '\r';
+    txBuffer[txLength++] = '\n';
+}
+
+/** Formats every dirty channel into the transmit buffer as a single binary frame, and clears their
+* dirty bits.
+*/
+static void telemetry_format_binary(void)
+{
+    uint8_t payload[TELEMETRY_CHANNELS * 2];
+    uint8_t length = 0;
+
+    for (uint8_t channel = 0; channel < TELEMETRY_CHANNELS; channel++) {
+        if (dirty & (1 << channel)) {
+            payload[length++] = pgm_read_byte(&channels[channel].tag);
+            payload[length++] = values[channel];
+        }
+    }
+    dirty = 0;
+    txLength = frame_encode(txBuffer, payload, length);
+}
+
+/** Returns the next telemetry byte to be sent. Called from the UART data register empty ISR.
+*
+* Variables:
+* start: true if a new line or frame may be started, false to only continue the current one
+*
+* Returns:
+* byte: the next byte to send, or -1 if there is nothing to send
+*/
+int16_t telemetry_next_byte(uint8_t start)
+{
+    if (txPos == txLength) {
+        if (!start || !dirty) {
+            return -1;
+        }
+
+        if (wireMode == WIRE_MODE_BINARY) {
+            telemetry_format_binary();
+        } else {
+            /* Find the next dirty channel */
+            while (!(dirty & (1 << nextChannel))) {
+                nextChannel = (nextChannel + 1) % TELEMETRY_CHANNELS;
+            }
+            dirty &= ~(1 << nextChannel);
+            telemetry_format_text(nextChannel);
+            nextChannel = (nextChannel + 1) % TELEMETRY_CHANNELS;
+        }
+        txPos = 0;
+    }
+
+    return txBuffer[txPos++];
+}
+
+/** Sends a reply to a GUI query in the current wire mode. In text mode the reply is the tag
+* followed by the values in ASCII separated by commas. In binary mode it is a frame holding the tag
+* followed by the values as 16 bit little endian numbers.
+*
+* Variables:
+* tag: the letter identifying the reply
+* values: the values to send
+* count: the number of values (at most 7)
+*/
+void telemetry_reply(char tag, const uint16_t* values, uint8_t count)
+{
+    if (count > (FRAME_MAX_PAYLOAD - 1) / 2) {
+        count = (FRAME_MAX_PAYLOAD - 1) / 2;
+    }
+
+    if (wireMode == WIRE_MODE_BINARY) {
+        uint8_t payload[FRAME_MAX_PAYLOAD];
+        uint8_t frame[FRAME_MAX];
+        uint8_t length = 0;
+
+        payload[length++] = tag;
+        for (uint8_t i = 0; i < count; i++) {
+            payload[length++] = values[i] & 0xFF;
+            payload[length++] = values[i] >> 8;
+        }
+        uart_write(frame, frame_encode(frame, payload, length));
+    } else {
+        printf("%c", tag);
+        for (uint8_t i = 0; i < count; i++) {
+            printf(i ? ",%u" : "%u", values[i]);
+        }
+        printf("\n");
+    }
+}
+
+/** Switches the GUI link wire mode. The switch is acknowledged with an 'M' reply holding the new
+* mode, sent in the old mode so the GUI can still read it, once every changed setting has been
+* saved. Everything after it uses the new mode.
+*
+* Variables:
+* mode: '1' for binary mode, anything else for text mode
+*/
+void set_wire_mode(uint8_t mode)
+{
+    uint16_t newMode = (mode == '1') ? WIRE_MODE_BINARY : WIRE_MODE_TEXT;
+
+    flush_settings(); // Settings sent before the switch are saved before it is acked.
+    telemetry_reply(WIRE_MODE[0], &newMode, 1);
+    wireMode = newMode;
+}
+
+/** Returns the current wire mode (WIRE_MODE_TEXT or WIRE_MODE_BINARY) */
+uint8_t telemetry_mode(void)
+{
+    return wireMode;
+}
@@ -0,0 +1,75 @@
+/*
+**************************************************************************************************************
+* file: telemetry.h
+* brief: Latest value telemetry to the GUI
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+
+/* Telemetry channels, each one has a single slot holding its latest value */
+#define TELEMETRY_BUTTONS 0 // Sent as BUTTON followed by the raw button byte
+#define TELEMETRY_X 1 // Sent as JOYSTICK_X followed by 0, 1 (-X) or 2 (+X) in ASCII
+#define TELEMETRY_Y 2 // Sent as JOYSTICK_Y followed by 0, 1 (-Y) or 2 (+Y) in ASCII
+#define TELEMETRY_DPAD_MODE 3 // Sent as DPAD_MODE followed by 0 or 1 in ASCII
+#define TELEMETRY_VOLUME 4 // Sent as VOLUME followed by the volume in ASCII
+#define TELEMETRY_CHANNELS 5
+
+#define TELEMETRY_REFRESH_MS 250 // Every channel is resent this often even if it hasn't changed
+
+/* Wire modes for the GUI link. Text mode is used from boot so older GUIs keep working. */
+#define WIRE_MODE_TEXT 0 // One "<tag><value>\r\n" line per value
+#define WIRE_MODE_BINARY 1 // Binary frames holding several fields each, see frame.h
+
+/** Stores the latest value of a channel. If the value has changed the channel is marked to be sent
+* by the UART transmit interrupt once the link is free. Never blocks.
+*
+* Variables:
+* channel: the channel to update (TELEMETRY_BUTTONS, TELEMETRY_X, etc.)
+* value: the latest value of the channel
+*/
+void telemetry_set(uint8_t channel, uint8_t value);
+
+/** Marks every channel to be sent so a GUI that connects late still sees the current state. Run by
+* the scheduler every TELEMETRY_REFRESH_MS.
+*/
+void telemetry_task(void);
+
+/** Returns the next telemetry byte to be sent. Called from the UART data register empty ISR.
+*
+* Variables:
+* start: true if a new line or frame may be started, false to only continue the current one
+*
+* Returns:
+* byte: the next byte to send, or -1 if there is nothing to send
+*/
+int16_t telemetry_next_byte(uint8_t start);
+
+/** Sends a reply to a GUI query in the current wire mode. In text mode the reply is the tag
+* followed by the values in ASCII separated by commas. In binary mode it is a frame holding the tag
+* followed by the values as 16 bit little endian numbers.
+*
+* Variables:
+* tag: the letter identifying the reply
+* values: the values to send
+* count: the number of values (at most 7)
+*/
+void telemetry_reply(char tag, const uint16_t* values, uint8_t count);
+
+/** Switches the GUI link wire mode. The switch is acknowledged with an 'M' reply holding the new
+* mode, sent in the old mode so the GUI can still read it, once every changed setting has been
+* saved. Everything after it uses the new mode.
+*
+* Variables:
+* mode: '1' for binary mode, anything else for text mode
+*/
+void set_wire_mode(uint8_t mode);
+
+/** Returns the current wire mode (WIRE_MODE_TEXT or WIRE_MODE_BINARY) */
+uint8_t telemetry_mode(void);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+**************************************************************************************************************
+* file: timer.c
+* brief: Free running Timer1 time base
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#include "timer.h"
+#include "hardware.h"
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+static volatile uint16_t ticks;
+
+/** Initialises Timer1 as a free running 16 bit counter clocked at 1MHz (F_CPU / 8), so one timer
+* tick is one microsecond and the counter wraps every 65.536ms.
+*/
+void timer1_init(void)
+{
+    /* Normal mode, no output compare pins */
+    TCCR1A = 0;
+    TCNT1 = 0;
+    ticks = 0;
+
+    /* Set up the system tick on compare B */
+    OCR1B = TICK_PERIOD_US;
+    TIFR1 = (1 << OCF1B);
+    TIMSK1 |= (1 << OCIE1B);
+
+    /* Start timer, prescalar of 8 */
+    TCCR1B = (1 << CS11);
+}
+
+/** Reads the current Timer1 count.
+*
+* Returns:
+* now: the current time in microseconds (modulo 65536)
+*/
+uint16_t timer_now(void)
+{
+    uint16_t now;
+
+    /* 16 bit timer registers share a temporary register with the ISRs */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = TCNT1;
+    }
+    return now;
+}
+
+/** Reads the number of system ticks since Timer1 was initialised.
+*
+* Returns:
+* ticks: the time in milliseconds (modulo 65536)
+*/
+uint16_t timer_ticks(void)
+{
+    uint16_t now;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = ticks;
+    }
+    return now;
+}
+
+/** Timer1 Compare B ISR.
+*
+* System tick. Schedules the next tick one period after this one, so the period does not drift
+* with interrupt latency, and samples the inputs.
+*/
+ISR(TIMER1_COMPB_vect)
+{
+    OCR1B += TICK_PERIOD_US;
+    ticks++;
+    input_scan();
+}
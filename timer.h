@@ -0,0 +1,39 @@
+/*
+**************************************************************************************************************
+* file: timer.h
+* brief: Free running Timer1 time base
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <stdint.h>
+
+#define TICK_PERIOD_US 1000 // System tick period, the input scan rate
+
+/** Initialises Timer1 as a free running 16 bit counter clocked at 1MHz (F_CPU / 8), so one timer
+* tick is one microsecond and the counter wraps every 65.536ms.
+*
+* Compare channel B generates the 1kHz system tick which counts milliseconds and scans the inputs.
+* Compare channel A is left for other modules to use as a one-shot event by programming OCR1A
+* relative to the current count.
+*/
+void timer1_init(void);
+
+/** Reads the current Timer1 count.
+*
+* Returns:
+* now: the current time in microseconds (modulo 65536)
+*/
+uint16_t timer_now(void);
+
+/** Reads the number of system ticks since Timer1 was initialised.
+*
+* Returns:
+* ticks: the time in milliseconds (modulo 65536)
+*/
+uint16_t timer_ticks(void);
+
+#endif
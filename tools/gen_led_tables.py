@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Generates led_tables.h, the gamma table and animation keyframes used by led.c.
+
+Run from the repository root after changing any of the parameters below:
+    python3 tools/gen_led_tables.py > led_tables.h
+
+There is no build step that runs this, so check the checked in header still matches before a release:
+    python3 tools/gen_led_tables.py --check
+"""
+
+import math
+import os
+import sys
+
+GAMMA = 2.2
+
+# Breathing dims the base colour down to BREATHE_LOW and back over BREATHE_PERIOD_MS
+BREATHE_PERIOD_MS = 3000
+BREATHE_LOW = 40
+BREATHE_KEYFRAMES = 16
+
+# Fading to a new colour blends from the old colour to the new one over FADE_MS
+FADE_MS = 400
+
+# A press flash jumps to full white, holds, then decays back to the base colour
+FLASH_HOLD_MS = 40
+FLASH_DECAY_MS = 200
+
+
+def gamma_table():
+    return [int(255 * (i / 255) ** GAMMA + 0.5) for i in range(256)]
+
+
+def breathe_keyframes():
+    frames = []
+    for i in range(BREATHE_KEYFRAMES + 1):
+        phase = i / BREATHE_KEYFRAMES
+        level = BREATHE_LOW + (255 - BREATHE_LOW) * (1 + math.cos(2 * math.pi * phase)) / 2
+        frames.append((int(BREATHE_PERIOD_MS * phase + 0.5), int(level + 0.5)))
+    return frames
+
+
+def fade_keyframes():
+    return [(0, 0), (FADE_MS, 255)]
+
+
+def flash_keyframes():
+    return [(0, 255), (FLASH_HOLD_MS, 255), (FLASH_HOLD_MS + FLASH_DECAY_MS, 0)]
+
+
+def format_bytes(values, per_line=16):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append("    " + ", ".join("%3d" % v for v in values[i:i + per_line]) + ",")
+    return "\n".join(lines)
+
+
+def format_keyframes(name, frames, comment):
+    out = ["/* %s */" % comment,
+           "static const Keyframe %s[] PROGMEM = {" % name]
+    out += ["    { %d, %d }," % frame for frame in frames]
+    out.append("};")
+    return "\n".join(out)
+
+
+def generate():
+    out = []
+    out.append("""/*
+**************************************************************************************************************
+* file: led_tables.h
+* brief: LED gamma table and animation keyframes, generated by tools/gen_led_tables.py. Do not edit.
+* author: ENGG2800 Team 7
+**************************************************************************************************************
+*/
+
+#ifndef __LED_TABLES_H__
+#define __LED_TABLES_H__
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+/* One point of an animation, the level is reached timeMs after the animation starts */
+typedef struct {
+    uint16_t timeMs;
+    uint8_t level;
+} Keyframe;
+""")
+    out.append("/* Perceived brightness to duty cycle, gamma %.1f */" % GAMMA)
+    out.append("static const uint8_t gammaTable[256] PROGMEM = {")
+    out.append(format_bytes(gamma_table()))
+    out.append("};")
+    out.append("")
+    out.append(format_keyframes("breatheFrames", breathe_keyframes(),
+                                "Brightness of the base colour while breathing, repeats every %dms" % BREATHE_PERIOD_MS))
+    out.append("")
+    out.append(format_keyframes("fadeFrames", fade_keyframes(),
+                                "Amount of the new colour mixed in while fading to it"))
+    out.append("")
+    out.append(format_keyframes("flashFrames", flash_keyframes(),
+                                "Amount of white mixed in after a button press"))
+    out.append("")
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    text = generate()
+    if sys.argv[1:] == ["--check"]:
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "led_tables.h")
+        with open(path) as f:
+            if f.read() != text:
+                sys.exit("led_tables.h is out of date, run: python3 tools/gen_led_tables.py > led_tables.h")
+        return
+    sys.stdout.write(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -29,40 +29,61 @@
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
-
-/* Setting clock rate */
-#define SYSCLK 8000000L
-#define F_CPU 8000000
+#include <util/atomic.h>
+
+#include "macros.h" // Setting clock rate
+#include "memory.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "timer.h"
+#include "uart.h"
 #include <util/delay.h>
 
 /* Global variables */
-/* Circular buffer to hold outgoing characters. The insert_pos variable
- * keeps track of the position (0 to OUTPUT_BUFFER_SIZE-1) that the next
- * outgoing character should be written to. bytes_in_buffer keeps
- * count of the number of characters currently stored in the buffer 
- * (ranging from 0 to OUTPUT_BUFFER_SIZE). This number of bytes immediately
- * prior to the current insert_pos are the bytes waiting to be output.
- * If the insert_pos reaches the end of the buffer it will wrap around
- * to the beginning (assuming those bytes have been output).
- * NOTE - OUTPUT_BUFFER_SIZE can not be larger than 255 without changing
- * the type of the variables below (currently defined as 8 bit unsigned ints).
+/* Circular buffers to hold outgoing and incoming characters. Each buffer has
+ * exactly one producer and one consumer: the output buffer is filled by the
+ * main program and emptied by the data register empty ISR, the input buffer
+ * is filled by the receive complete ISR and emptied by the main program.
+ * The producer only ever writes head and the consumer only ever writes tail,
+ * and each is a single byte, so neither side needs to disable interrupts.
+ * A byte is stored before head is moved past it, so the consumer never sees
+ * a byte that hasn't been written yet.
+ * The sizes must be powers of 2 no larger than 128 so the free running 8 bit
+ * indices can be wrapped with a mask, and head - tail is always the number
+ * of bytes in the buffer.
+ * Setting UDRIE0 is a read-modify-write that the ISR can race with, but the
+ * ISR only ever clears it once the buffer is empty, so at worst the ISR runs
+ * once more and finds nothing to send.
  */
-#define OUTPUT_BUFFER_SIZE 255
+#define OUTPUT_BUFFER_SIZE 128
+#define OUTPUT_BUFFER_MASK (OUTPUT_BUFFER_SIZE - 1)
 volatile char out_buffer[OUTPUT_BUFFER_SIZE];
-volatile uint8_t out_insert_pos;
-volatile uint8_t bytes_in_out_buffer;
+volatile uint8_t out_head;
+volatile uint8_t out_tail;
+volatile uint8_t out_line_open; // Set while a text line has been started but not finished
 
-/* Circular buffer to hold incoming characters. Works on same principle
- * as output buffer
- */
-#define INPUT_BUFFER_SIZE 16
+#define INPUT_BUFFER_SIZE 32 // Holds a full size binary frame
+#define INPUT_BUFFER_MASK (INPUT_BUFFER_SIZE - 1)
 volatile char input_buffer[INPUT_BUFFER_SIZE];
-volatile uint8_t input_insert_pos;
-volatile uint8_t bytes_in_input_buffer;
-volatile uint8_t input_overrun;
+volatile uint8_t input_head;
+volatile uint8_t input_tail;
 
 static int8_t do_echo;
 
+/* Baud rates the GUI can ask for. All of them are within UART_MAX_BAUD_ERROR at 8MHz with U2X. */
+static const long baudRates[UART_BAUD_RATES] = { 9600, 38400, 76800, 250000 };
+
+/* Baud rate switch states */
+#define BAUD_STABLE 0 // Not switching
+#define BAUD_DRAINING 1 // Waiting for the ack to be sent at the old rate
+#define BAUD_SETTLING 2 // Ack sent, waiting for the last byte to leave the shift register
+#define BAUD_PROBATION 3 // Switched, waiting for a valid frame at the new rate
+
+static uint8_t baudState = BAUD_STABLE;
+static uint8_t baudRequested; // Index into baudRates of the rate being switched to
+static uint16_t baudTimer; // Tick count when probation started
+static volatile uint8_t tx_hold; // Set to stop new telemetry starting while switching baud rate
+
 /* FUNCTION PROTOTYPES */
 static int uart_put_char(char, FILE*);
 static int uart_get_char(FILE*);
@@ -71,21 +92,51 @@ static int uart_get_char(FILE*);
 static FILE myStream = FDEV_SETUP_STREAM(uart_put_char, uart_get_char,
     _FDEV_SETUP_RW);
 
+/** Sets the UART baud rate using double speed mode (U2X0), which gives a smaller error than
+* normal mode at 8MHz. Rates with an error above UART_MAX_BAUD_ERROR are rejected.
+*
+* Variables:
+* baudrate: the baud rate to use
+*
+* Returns:
+* 0 if the baud rate was set, 1 if it was rejected and the old rate kept
+*/
+int8_t uart_set_baud(long baudrate)
+{
+    /* Rounded UBRR for double speed mode, and the baud rate it actually gives */
+    long ubrr = ((SYSCLK / (4 * baudrate)) + 1) / 2 - 1;
+    if (ubrr < 0 || ubrr > 4095) {
+        return 1;
+    }
+    long actual = SYSCLK / (8 * (ubrr + 1));
+    long error = actual > baudrate ? actual - baudrate : baudrate - actual;
+
+    if (error * 1000 > baudrate * UART_MAX_BAUD_ERROR) {
+        return 1;
+    }
+
+    UCSR0A |= (1 << U2X0);
+    UBRR0 = ubrr;
+    return 0;
+}
+
 void init_serial_stdio(long baudrate, int8_t echo)
 {
-    uint16_t ubrr;
     /* Initialising the buffer */
-    out_insert_pos = 0;
-    bytes_in_out_buffer = 0;
-    input_insert_pos = 0;
-    bytes_in_input_buffer = 0;
-    input_overrun = 0;
+    out_head = 0;
+    out_tail = 0;
+    out_line_open = 0;
+    input_head = 0;
+    input_tail = 0;
 
     do_echo = echo;
 
     /* Set the baud rate for UART */
-    ubrr = ((SYSCLK / (8 * baudrate)) + 1) / 2 - 1;
-    UBRR0 = ubrr;
+    if (uart_set_baud(baudrate)) {
+        uart_set_baud(UART_BAUD_DEFAULT);
+    }
+    baudState = BAUD_STABLE;
+    tx_hold = 0;
 
     UCSR0B = (1 << RXEN0) | (1 << TXEN0); // Enable RX and TX for UART.
 
@@ -103,7 +154,90 @@ void init_serial_stdio(long baudrate, int8_t echo)
 */
 int8_t serial_input_available(void)
 {
-    return (bytes_in_input_buffer != 0);
+    return (input_head != input_tail);
+}
+
+/** Starts switching to one of the baud rates in baudRates. The request is acked with a 'U' reply at
+* the current rate once every changed setting has been saved. Once the ack has been sent the rate
+* is changed, and if no frame with a valid CRC is received at the new rate within
+* UART_BAUD_PROBATION_MS it falls back to UART_BAUD_DEFAULT.
+*
+* Variables:
+* index: the ASCII index of the requested rate ('0' = 9600, '1' = 38400, '2' = 76800, '3' = 250000)
+*/
+void request_baud(uint8_t index)
+{
+    uint16_t reply = index - '0';
+
+    if (baudState != BAUD_STABLE || reply >= UART_BAUD_RATES) {
+        reply = UART_BAUD_NACK;
+        telemetry_reply(BAUD_RATE[0], &reply, 1);
+        return;
+    }
+
+    flush_settings(); // Settings sent before the switch are saved before it is acked.
+    telemetry_reply(BAUD_RATE[0], &reply, 1);
+    baudRequested = reply;
+    tx_hold = 1;
+    baudState = BAUD_DRAINING;
+}
+
+/** Tells the baud rate switch that a frame with a valid CRC has been received, which confirms the
+* GUI is talking at the new rate. Text commands have no check, so they never confirm it.
+*/
+void uart_baud_confirm(void)
+{
+    if (baudState == BAUD_PROBATION) {
+        baudState = BAUD_STABLE;
+    }
+}
+
+/** Moves the baud rate switch along. Run by the scheduler every 1ms. */
+void uart_baud_task(void)
+{
+    uint16_t now = timer_ticks();
+
+    switch (baudState) {
+    case BAUD_DRAINING:
+        /* The data register empty interrupt turns itself off once everything has been sent */
+        if (!(UCSR0B & (1 << UDRIE0))) {
+            baudState = BAUD_SETTLING;
+        }
+        break;
+    case BAUD_SETTLING:
+        /* TXC0 is cleared with every byte loaded, so it is only set once the last byte has
+         * left the shift register */
+        if (UCSR0A & (1 << TXC0)) {
+            if (uart_set_baud(baudRates[baudRequested])) {
+                baudState = BAUD_STABLE;
+            } else {
+                baudTimer = now;
+                baudState = BAUD_PROBATION;
+            }
+            tx_hold = 0;
+            uart_start_tx();
+        }
+        break;
+    case BAUD_PROBATION:
+        if ((uint16_t)(now - baudTimer) >= UART_BAUD_PROBATION_MS) {
+            uart_set_baud(UART_BAUD_DEFAULT);
+            baudState = BAUD_STABLE;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/** Turns on the UART data register empty interrupt so that waiting output, including telemetry,
+* is sent. Safe to call with or without interrupts enabled.
+*/
+void uart_start_tx(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        UCSR0B |= (1 << UDRIE0);
+    }
 }
 
 static int uart_put_char(char c, FILE* stream)
@@ -119,86 +253,151 @@ static int uart_put_char(char c, FILE* stream)
 	* If the buffer is full and interrupts are not enabled the function exits
 	*/
     interrupts_enabled = bit_is_set(SREG, SREG_I);
-    while (bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE) {
+    if ((uint8_t)(out_head - out_tail) >= OUTPUT_BUFFER_SIZE) {
         if (!interrupts_enabled) {
+            STATS_COUNT(txDrops);
             return 1;
         }
+        STATS_COUNT(txStalls);
+        while ((uint8_t)(out_head - out_tail) >= OUTPUT_BUFFER_SIZE)
+            ;
     }
 
-    /* Add the character to the buffer for transmission if there
-	 * is space to do so. Increment insert_pos. Interrupts are disable to 
-	 * prevent concurrent modification of the 
-	 * the buffer by the ISR.
-	*/
-    cli();
-    out_buffer[out_insert_pos++] = c;
-    bytes_in_out_buffer++;
-    if (out_insert_pos == OUTPUT_BUFFER_SIZE) {
-        /* Wrap around buffer pointer if necessary */
-        out_insert_pos = 0;
+    /* A line is marked open before its first char is visible to the ISR and
+     * only marked closed once its new line char is, so telemetry can't be
+     * started part way through it.
+     */
+    if (c != '\n') {
+        out_line_open = 1;
+    }
+    out_buffer[out_head & OUTPUT_BUFFER_MASK] = c;
+    out_head++;
+    if (c == '\n') {
+        out_line_open = 0;
     }
 
-    /* Re-enable interrupts */
     UCSR0B |= (1 << UDRIE0);
-    if (interrupts_enabled) {
-        sei();
+    return 0;
+}
+
+/** Writes a block of raw bytes to the output buffer without any new line translation. The whole
+* block is made visible to the ISR at once so it is never split by telemetry. If the buffer doesn't
+* have room the function waits for it if interrupts are enabled, or discards the block if they
+* aren't.
+*
+* Variables:
+* data: the bytes to send
+* length: the number of bytes in data
+*
+* Returns:
+* 0 if the bytes were buffered, 1 if they were discarded
+*/
+int8_t uart_write(const uint8_t* data, uint8_t length)
+{
+    uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+
+    if (OUTPUT_BUFFER_SIZE - (uint8_t)(out_head - out_tail) < length) {
+        if (!interrupts_enabled) {
+            STATS_COUNT(txDrops);
+            return 1;
+        }
+        STATS_COUNT(txStalls);
+        while (OUTPUT_BUFFER_SIZE - (uint8_t)(out_head - out_tail) < length)
+            ;
     }
+
+    uint8_t head = out_head;
+    for (uint8_t i = 0; i < length; i++) {
+        out_buffer[head++ & OUTPUT_BUFFER_MASK] = data[i];
+    }
+    out_head = head;
+
+    UCSR0B |= (1 << UDRIE0);
     return 0;
 }
 
 int uart_get_char(FILE* stream)
 {
+    int16_t c;
+
     /* Block until char is received */
-    while (bytes_in_input_buffer == 0) {
+    while ((c = uart_get_byte()) < 0) {
         /* do nothing */
     }
+    return c;
+}
 
-    /* Disable interrupts, remove char, re-enable interrupts */
-    uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
-    cli();
-    char c;
-    if (input_insert_pos - bytes_in_input_buffer < 0) {
-        /* Need to wrap around */
-        c = input_buffer[input_insert_pos - bytes_in_input_buffer
-            + INPUT_BUFFER_SIZE];
-    } else {
-        c = input_buffer[input_insert_pos - bytes_in_input_buffer];
+/** Removes the next received byte from the input buffer without blocking. If echo is on the byte
+* is echoed back here rather than in the receive ISR.
+*
+* Returns:
+* byte: the next received byte, or -1 if the input buffer is empty
+*/
+int16_t uart_get_byte(void)
+{
+    if (input_head == input_tail) {
+        return -1;
     }
 
-    /* Decrement our count of bytes in the input buffer */
-    bytes_in_input_buffer--;
-    if (interrupts_enabled) {
-        sei();
+    uint8_t c = input_buffer[input_tail & INPUT_BUFFER_MASK];
+    input_tail++;
+
+    if (do_echo) { // Echo the char if echo is enabled.
+        uart_put_char(c, 0);
     }
     return c;
 }
 
-/** Uart Data Register Empty ISR. */
+/** Loads a byte into the transmit register, clearing the transmit complete flag so that it
+* only gets set again once this byte has been fully sent.
+*
+* Variables:
+* c: the byte to send
+*/
+static inline void uart_load_byte(uint8_t c)
+{
+    UCSR0A |= (1 << TXC0);
+    UDR0 = c;
+}
+
+/** Uart Data Register Empty ISR.
+*
+* Telemetry lines and buffered output are only ever switched between at line or frame boundaries,
+* so they never end up mixed together on the wire.
+*/
 ISR(USART_UDRE_vect)
 {
-    if (bytes_in_out_buffer > 0) { // Check if we have data in our buffer.
+    /* Finish any telemetry line that has been started */
+    int16_t t = telemetry_next_byte(0);
+    if (t >= 0) {
+        uart_load_byte(t);
+        return;
+    }
+
+    if (out_head != out_tail) { // Check if we have data in our buffer.
         /* Output the pending char */
-        char c;
-        if (out_insert_pos - bytes_in_out_buffer < 0) {
-            /* Need to wrap around */
-            c = out_buffer[out_insert_pos - bytes_in_out_buffer
-                + OUTPUT_BUFFER_SIZE];
-        } else {
-            c = out_buffer[out_insert_pos - bytes_in_out_buffer];
-        }
-        /* Decrement counter for bytes in the the buffer */
-        bytes_in_out_buffer--;
+        uart_load_byte(out_buffer[out_tail & OUTPUT_BUFFER_MASK]);
+        out_tail++;
+        return;
+    }
 
-        UDR0 = c; // Output the char
-    } else {
-        /* Empty buffer. Disable the UART Data
-		 * Register Empty interrupt otherwise it 
-		 * will trigger again immediately this ISR exits. 
-		 * The interrupt is re-enabled when a character is
-		 * placed in the buffer.
-		 */
-        UCSR0B &= ~(1 << UDRIE0);
+    /* Buffer is empty so start sending any waiting telemetry, unless a line
+     * is still being written to the buffer */
+    if (!out_line_open && !tx_hold) {
+        t = telemetry_next_byte(1);
+        if (t >= 0) {
+            uart_load_byte(t);
+            return;
+        }
     }
+
+    /* Nothing to send. Disable the UART Data
+     * Register Empty interrupt otherwise it 
+     * will trigger again immediately this ISR exits. 
+     * The interrupt is re-enabled when a character is
+     * placed in the buffer or telemetry changes.
+     */
+    UCSR0B &= ~(1 << UDRIE0);
 }
 
 /** Uart Receive Complete ISR.
@@ -207,27 +406,15 @@ ISR(USART_UDRE_vect)
 */
 ISR(USART_RX_vect)
 {
-
     char c;
     c = UDR0; // Read the char.
 
-    if (do_echo && bytes_in_out_buffer < OUTPUT_BUFFER_SIZE) { // Echo the char is echo is enabled.
-        uart_put_char(c, 0);
-    }
-
     /* Check if buffer is full */
-    if (bytes_in_input_buffer >= INPUT_BUFFER_SIZE) { // If full set overrun flag and ignore char.
-        input_overrun = 1;
+    if ((uint8_t)(input_head - input_tail) >= INPUT_BUFFER_SIZE) { // If full count the overrun and ignore char.
+        STATS_COUNT(rxOverruns);
     } else {
-        if (c == '\r') { // Convert carriage return to new line.
-            c = '\n';
-        }
-
-        /* The buffer is not full */
-        input_buffer[input_insert_pos++] = c;
-        bytes_in_input_buffer++;
-        if (input_insert_pos == INPUT_BUFFER_SIZE) {
-            input_insert_pos = 0;
-        }
+        /* The buffer is not full. Bytes are stored as received, binary frames can hold any value. */
+        input_buffer[input_head & INPUT_BUFFER_MASK] = c;
+        input_head++;
     }
 }
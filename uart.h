@@ -9,9 +9,48 @@
 #ifndef __UART_H__
 #define __UART_H__
 
-/** Initialises UART communication for the Atmega */
+#include <stdint.h>
+
+#define UART_BAUD_DEFAULT 9600 // Used at boot and whenever a baud rate switch fails
+#define UART_MAX_BAUD_ERROR 20 // Largest baud rate error allowed, in parts per thousand
+#define UART_BAUD_RATES 4 // Number of baud rates the GUI can ask for
+#define UART_BAUD_NACK 0xFF // 'U' reply value when a baud rate request is refused
+#define UART_BAUD_PROBATION_MS 1000 // Time allowed for a valid frame after a baud rate switch
+
+/** Initialises UART communication for the Atmega. Falls back to UART_BAUD_DEFAULT if the baud rate
+* is rejected by uart_set_baud().
+*/
 void init_serial_stdio(long baudrate, int8_t echo);
 
+/** Sets the UART baud rate using double speed mode (U2X0), which gives a smaller error than
+* normal mode at 8MHz. Rates with an error above UART_MAX_BAUD_ERROR are rejected.
+*
+* Variables:
+* baudrate: the baud rate to use
+*
+* Returns:
+* 0 if the baud rate was set, 1 if it was rejected and the old rate kept
+*/
+int8_t uart_set_baud(long baudrate);
+
+/** Starts switching to one of the supported baud rates. The request is acked with a 'U' reply at
+* the current rate once every changed setting has been saved. Once the ack has been sent the rate
+* is changed, and if no frame with a valid CRC is received at the new rate within
+* UART_BAUD_PROBATION_MS it falls back to UART_BAUD_DEFAULT.
+*
+* Variables:
+* index: the ASCII index of the requested rate ('0' = 9600, '1' = 38400, '2' = 76800, '3' = 250000)
+*/
+void request_baud(uint8_t index);
+
+/** Tells the baud rate switch that a frame with a valid CRC has been received, which confirms the
+* GUI is talking at the new rate. Text commands have no check, so they never confirm it.
+*/
+void uart_baud_confirm(void);
+
+/** Moves the baud rate switch along. Run by the scheduler every 1ms. */
+void uart_baud_task(void);
+
 /** Checks if there is data waiting to be read in the buffer 
 *
 * Returns:
@@ -19,4 +58,29 @@ void init_serial_stdio(long baudrate, int8_t echo);
 */
 int8_t serial_input_available(void);
 
+/** Removes the next received byte from the input buffer without blocking.
+*
+* Returns:
+* byte: the next received byte, or -1 if the input buffer is empty
+*/
+int16_t uart_get_byte(void);
+
+/** Writes a block of raw bytes to the output buffer without any new line translation. The whole
+* block is added at once so it is never split by telemetry. If the buffer doesn't have room the
+* function waits for it if interrupts are enabled, or discards the block if they aren't.
+*
+* Variables:
+* data: the bytes to send
+* length: the number of bytes in data
+*
+* Returns:
+* 0 if the bytes were buffered, 1 if they were discarded
+*/
+int8_t uart_write(const uint8_t* data, uint8_t length);
+
+/** Turns on the UART data register empty interrupt so that waiting output, including telemetry,
+* is sent. Safe to call with or without interrupts enabled.
+*/
+void uart_start_tx(void);
+
 #endif
\ No newline at end of file